@@ -94,6 +94,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	kusage_syscall(&curthread->t_ru, callno);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -179,6 +180,14 @@ syscall(struct trapframe *tf)
    	    	err = sys_execv((const char*) tf->tf_a0, (char**) tf->tf_a1, &retval);
    	    break;
 
+   	    case SYS_getrusage:
+   	    	err = sys_getrusage((int) tf->tf_a0, (struct rusage*) tf->tf_a1, &retval);
+   	    break;
+
+   	    case SYS_spawn:
+   	    	err = sys_spawn((const char*) tf->tf_a0, (char**) tf->tf_a1, (const int*) tf->tf_a2, (int) tf->tf_a3, &retval);
+   	    break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
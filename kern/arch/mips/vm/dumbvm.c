@@ -0,0 +1,1078 @@
+/*
+ * SPB & FAR
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * Dumb MIPS-only "VM system" that is intended to only be just barely
+ * enough to struggle off the ground.
+ */
+
+/* under dumbvm, always have 48k of user stack */
+#define DUMBVM_STACKPAGES    12
+
+/*
+ * SPB & FAR
+ * Address space IDs.
+ *
+ * EntryHi carries a 6-bit PID that the TLB matches against along with
+ * the page number, so entries belonging to different address spaces
+ * can sit in the TLB side by side and as_activate doesn't have to
+ * wipe it on every process switch.
+ *
+ * ASIDs are handed out in order from 1 to ASID_MAX (0 is left unused
+ * so a zeroed EntryHi never matches a user mapping). When they run out
+ * the generation is bumped and numbering starts over; an address space
+ * whose as_asidgen is stale gets a fresh ASID the next time it is
+ * activated, and each cpu flushes its TLB once when it first loads an
+ * ASID from the new generation. An ASID is never handed out twice in
+ * one generation, so entries left behind by destroyed or stale address
+ * spaces can never be hit and need no shootdown.
+ */
+#define TLBHI_PIDSHIFT	6
+#define TLBHI_PID	0x00000fc0
+#define ASID_MAX	(TLBHI_PID >> TLBHI_PIDSHIFT)
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static unsigned asid_next = 1;
+static unsigned asid_generation = 1;
+
+/*
+ * SPB & FAR
+ * Copy-on-write. as_copy doesn't copy anything: the new address space
+ * gets the old one's physical regions, and the two share a cowshare
+ * per region. While a region is shared it is only ever mapped
+ * read-only; the first write fault from either side gives that side
+ * its own copy of the region (dumbvm regions are physically
+ * contiguous, so the whole region is copied, not just the page). The
+ * last one left keeps the original frames.
+ */
+struct cowshare {
+	struct spinlock cs_lock;
+	unsigned cs_refcount;		/* address spaces sharing the frames */
+};
+
+/*
+ * SPB & FAR
+ * Shared text. Once a read-only segment has been loaded, loadelf.c can
+ * keep a textshare of it: a cowshare reference of its own on the
+ * region's frames, so that later execs of the same program map those
+ * frames instead of allocating and reading the segment again. Because
+ * the textshare counts as a sharer, the frames are never written; a
+ * process that writes its text gets a private copy like any COW write.
+ */
+struct textshare {
+	struct spinlock ts_lock;
+	unsigned ts_refcount;
+	struct cowshare *ts_cow;
+	struct pagefill *ts_fill;
+	paddr_t ts_pbase;
+	size_t ts_npages;
+};
+
+/*
+ * SPB & FAR
+ * Demand filling. A region's frames are still allocated in one piece
+ * by as_prepare_load, but nothing is written into them until a page
+ * is first touched: vm_fault then zeroes it and reads whatever part of
+ * it comes from the file. Stack and BSS pages are zero-fill only.
+ *
+ * The pagefill says which pages of a region's frames hold their
+ * contents. It goes with the frames, not the address space, so it is
+ * shared (refcounted) by everybody sharing them: fork, or mapped
+ * text. pf_lock is held while filling so two sharers don't fill the
+ * same page at once. Before a region is copied for copy-on-write it is
+ * filled completely, and the private copy needs no pagefill.
+ */
+struct pagefill {
+	struct lock *pf_lock;
+	unsigned pf_refcount;
+	struct vnode *pf_vnode;		/* NULL: zero-fill only */
+	vaddr_t pf_vbase;		/* start of the region */
+	vaddr_t pf_segvaddr;		/* where the file contents go */
+	off_t pf_offset;		/* ...and where they are in the file */
+	size_t pf_filesz;
+	size_t pf_npages;
+	uint8_t *pf_filled;		/* bitmap, a bit per page */
+};
+
+/*
+ * Wrap this in a spinlock to keep memory allocation from
+ * interleaving with itself.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+void
+vm_bootstrap(void)
+{
+	/* Do nothing. */
+}
+
+static
+paddr_t
+getppages(unsigned long npages)
+{
+	paddr_t addr;
+
+	spinlock_acquire(&stealmem_lock);
+
+	addr = ram_stealmem(npages);
+
+	spinlock_release(&stealmem_lock);
+	return addr;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+	pa = getppages(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	/* nothing - leak the memory. */
+
+	(void)addr;
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
+/*
+ * Load ASID into the PID field of EntryHi. The tlb_* routines all
+ * overwrite EntryHi, so this also has to be redone after using them.
+ */
+static
+void
+tlb_setasid(unsigned asid)
+{
+	uint32_t ehi = asid << TLBHI_PIDSHIFT;
+
+	__asm volatile("mtc0 %0, $10" : : "r" (ehi));
+}
+
+/*
+ * Invalidate this cpu's whole TLB. Called with interrupts off.
+ */
+static
+void
+tlb_flush(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlb_flushes++;
+}
+
+/*
+ * Make sure AS holds an ASID from the current generation, and make
+ * sure this cpu's TLB doesn't hold anything from an older one.
+ * Called with interrupts off.
+ */
+static
+void
+asid_assign(struct addrspace *as)
+{
+	unsigned gen;
+
+	spinlock_acquire(&asid_lock);
+	if (as->as_asidgen != asid_generation) {
+		if (asid_next > ASID_MAX) {
+			asid_generation++;
+			asid_next = 1;
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_generation;
+	}
+	gen = asid_generation;
+	spinlock_release(&asid_lock);
+
+	if (curcpu->c_asidgen != gen) {
+		tlb_flush();
+		curcpu->c_asidgen = gen;
+	}
+}
+
+/*
+ * Throw away AS's ASID. Every TLB entry on every cpu that was made
+ * for it becomes unreachable, which is how mappings get revoked: it
+ * beats hunting them down with shootdowns.
+ *
+ * That only works if no cpu goes on using the old ASID. A cpu that
+ * last ran AS (before its thread migrated) still has it in EntryHi
+ * and in c_curas, and would skip as_activate when the thread comes
+ * back; so make every cpu forget AS, and if AS is the current address
+ * space, activate it again here to load its new ASID right away.
+ */
+static
+void
+asid_retire(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	as->as_asidgen = 0;
+	splx(spl);
+
+	thread_as_forget(as);
+	if (as == curthread->t_addrspace) {
+		thread_as_activate(as);
+	}
+}
+
+/*
+ * Start sharing a region. *SHAREP belongs to the address space being
+ * copied; it gets a cowshare if it didn't have one. Returns the share
+ * for the copy, or NULL if out of memory.
+ */
+static
+struct cowshare *
+cow_share(struct cowshare **sharep)
+{
+	struct cowshare *cs = *sharep;
+
+	if (cs == NULL) {
+		cs = kmalloc(sizeof(*cs));
+		if (cs == NULL) {
+			return NULL;
+		}
+		spinlock_init(&cs->cs_lock);
+		cs->cs_refcount = 1;
+		*sharep = cs;
+	}
+
+	spinlock_acquire(&cs->cs_lock);
+	cs->cs_refcount++;
+	spinlock_release(&cs->cs_lock);
+	return cs;
+}
+
+/*
+ * Stop sharing a region. The last one out frees the share.
+ */
+static
+void
+cow_unshare(struct cowshare *cs)
+{
+	bool last;
+
+	spinlock_acquire(&cs->cs_lock);
+	KASSERT(cs->cs_refcount > 0);
+	cs->cs_refcount--;
+	last = (cs->cs_refcount == 0);
+	spinlock_release(&cs->cs_lock);
+
+	if (last) {
+		spinlock_cleanup(&cs->cs_lock);
+		kfree(cs);
+	}
+}
+
+/*
+ * New zero-fill-only pagefill for a region of NPAGES pages at VBASE.
+ */
+static
+struct pagefill *
+pagefill_create(vaddr_t vbase, size_t npages)
+{
+	struct pagefill *pf;
+
+	pf = kmalloc(sizeof(*pf));
+	if (pf == NULL) {
+		return NULL;
+	}
+	pf->pf_filled = kmalloc(DIVROUNDUP(npages, 8));
+	if (pf->pf_filled == NULL) {
+		kfree(pf);
+		return NULL;
+	}
+	pf->pf_lock = lock_create("pagefill");
+	if (pf->pf_lock == NULL) {
+		kfree(pf->pf_filled);
+		kfree(pf);
+		return NULL;
+	}
+	bzero(pf->pf_filled, DIVROUNDUP(npages, 8));
+	pf->pf_refcount = 1;
+	pf->pf_vnode = NULL;
+	pf->pf_vbase = vbase;
+	pf->pf_segvaddr = vbase;
+	pf->pf_offset = 0;
+	pf->pf_filesz = 0;
+	pf->pf_npages = npages;
+	return pf;
+}
+
+/*
+ * Another reference to PF, which may be NULL.
+ */
+static
+struct pagefill *
+pagefill_share(struct pagefill *pf)
+{
+	if (pf != NULL) {
+		lock_acquire(pf->pf_lock);
+		pf->pf_refcount++;
+		lock_release(pf->pf_lock);
+	}
+	return pf;
+}
+
+static
+void
+pagefill_release(struct pagefill *pf)
+{
+	bool last;
+
+	lock_acquire(pf->pf_lock);
+	KASSERT(pf->pf_refcount > 0);
+	pf->pf_refcount--;
+	last = (pf->pf_refcount == 0);
+	lock_release(pf->pf_lock);
+
+	if (last) {
+		if (pf->pf_vnode != NULL) {
+			VOP_DECREF(pf->pf_vnode);
+		}
+		lock_destroy(pf->pf_lock);
+		kfree(pf->pf_filled);
+		kfree(pf);
+	}
+}
+
+/*
+ * Give page PAGE of the region whose frames start at PBASE its
+ * contents, if it doesn't have them yet. Caller holds pf_lock.
+ */
+static
+int
+pagefill_page_locked(struct pagefill *pf, paddr_t pbase, unsigned page)
+{
+	vaddr_t pagevaddr, start, end;
+	char *kpage;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(page < pf->pf_npages);
+	if (pf->pf_filled[page / 8] & (1 << (page % 8))) {
+		return 0;
+	}
+
+	kpage = (char *)PADDR_TO_KVADDR(pbase + page * PAGE_SIZE);
+	bzero(kpage, PAGE_SIZE);
+
+	/* The part of the page, if any, that comes from the file */
+	pagevaddr = pf->pf_vbase + page * PAGE_SIZE;
+	start = pagevaddr > pf->pf_segvaddr ? pagevaddr : pf->pf_segvaddr;
+	end = pf->pf_segvaddr + pf->pf_filesz;
+	if (end > pagevaddr + PAGE_SIZE) {
+		end = pagevaddr + PAGE_SIZE;
+	}
+	if (pf->pf_vnode != NULL && start < end) {
+		uio_kinit(&iov, &ku, kpage + (start - pagevaddr), end - start,
+			  pf->pf_offset + (start - pf->pf_segvaddr), UIO_READ);
+		result = VOP_READ(pf->pf_vnode, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("dumbvm: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
+	}
+
+	pf->pf_filled[page / 8] |= 1 << (page % 8);
+	return 0;
+}
+
+static
+int
+pagefill_page(struct pagefill *pf, paddr_t pbase, unsigned page)
+{
+	int result;
+
+	lock_acquire(pf->pf_lock);
+	result = pagefill_page_locked(pf, pbase, page);
+	lock_release(pf->pf_lock);
+	return result;
+}
+
+/*
+ * Fill every page that hasn't been yet.
+ */
+static
+int
+pagefill_all(struct pagefill *pf, paddr_t pbase)
+{
+	unsigned page;
+	int result = 0;
+
+	lock_acquire(pf->pf_lock);
+	for (page=0; page<pf->pf_npages; page++) {
+		result = pagefill_page_locked(pf, pbase, page);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(pf->pf_lock);
+	return result;
+}
+
+/*
+ * Write fault on a shared region of the current address space AS:
+ * make the region private, copying it unless everybody else already
+ * has. Only our own thread can add sharers (by forking), so if we're
+ * the only one left that can't change under us.
+ */
+static
+int
+cow_break(struct addrspace *as, paddr_t *pbasep, size_t npages,
+	  struct cowshare **sharep, struct pagefill **fillp)
+{
+	struct cowshare *cs = *sharep;
+	paddr_t newpbase;
+	bool alone;
+	int result;
+
+	/*
+	 * Bring the whole region in first, so what we copy is complete
+	 * and our private copy doesn't need the pagefill any more.
+	 */
+	if (*fillp != NULL) {
+		result = pagefill_all(*fillp, *pbasep);
+		if (result) {
+			return result;
+		}
+		pagefill_release(*fillp);
+		*fillp = NULL;
+	}
+
+	spinlock_acquire(&cs->cs_lock);
+	alone = (cs->cs_refcount == 1);
+	spinlock_release(&cs->cs_lock);
+
+	if (!alone) {
+		/*
+		 * Copy before dropping our reference; after that the
+		 * others may go ahead and write the old frames.
+		 */
+		newpbase = getppages(npages);
+		if (newpbase == 0) {
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(newpbase),
+			(const void *)PADDR_TO_KVADDR(*pbasep),
+			npages * PAGE_SIZE);
+		*pbasep = newpbase;
+	}
+
+	*sharep = NULL;
+	cow_unshare(cs);
+
+	/*
+	 * Our read-only mappings of the region are stale either way:
+	 * wrong frames, or not writeable.
+	 */
+	asid_retire(as);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	vaddr_t vbase;
+	paddr_t paddr, *pbasep;
+	size_t npages;
+	struct cowshare **sharep;
+	struct pagefill **fillp;
+	int i, result;
+	uint32_t ehi, elo;
+	struct addrspace *as;
+	int spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/* Only copy-on-write regions are mapped read-only */
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	as = curthread->t_addrspace;
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably a kernel
+		 * fault early in boot. Return EFAULT so as to panic
+		 * instead of getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	/* Assert that the address space has been set up properly. */
+	KASSERT(as->as_vbase1 != 0);
+	KASSERT(as->as_pbase1 != 0);
+	KASSERT(as->as_npages1 != 0);
+	KASSERT(as->as_vbase2 != 0);
+	KASSERT(as->as_pbase2 != 0);
+	KASSERT(as->as_npages2 != 0);
+	KASSERT(as->as_stackpbase != 0);
+	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
+	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
+	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
+	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
+	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	if (faultaddress >= vbase1 && faultaddress < vtop1) {
+		vbase = vbase1;
+		pbasep = &as->as_pbase1;
+		npages = as->as_npages1;
+		sharep = &as->as_cow1;
+		fillp = &as->as_fill1;
+	}
+	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
+		vbase = vbase2;
+		pbasep = &as->as_pbase2;
+		npages = as->as_npages2;
+		sharep = &as->as_cow2;
+		fillp = &as->as_fill2;
+	}
+	else if (faultaddress >= stackbase && faultaddress < stacktop) {
+		vbase = stackbase;
+		pbasep = &as->as_stackpbase;
+		npages = DUMBVM_STACKPAGES;
+		sharep = &as->as_cowstack;
+		fillp = &as->as_fillstack;
+	}
+	else {
+		return EFAULT;
+	}
+
+	if (*sharep == NULL && faulttype == VM_FAULT_READONLY) {
+		/* Private regions are always mapped writeable */
+		return EFAULT;
+	}
+	if (*fillp != NULL) {
+		/* First touch of the page? */
+		result = pagefill_page(*fillp, *pbasep,
+				       (faultaddress - vbase) / PAGE_SIZE);
+		if (result) {
+			return result;
+		}
+	}
+	if (*sharep != NULL && faulttype != VM_FAULT_READ) {
+		result = cow_break(as, pbasep, npages, sharep, fillp);
+		if (result) {
+			return result;
+		}
+	}
+	paddr = (faultaddress - vbase) + *pbasep;
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	curcpu->c_tlb_faults++;
+	curthread->t_ru.ru_faults++;
+
+	/*
+	 * We may have been switched out and the ASID generation rolled
+	 * over since as_activate; if so this picks up a fresh ASID, and
+	 * either way the PID in EntryHi matches the one we tag with.
+	 */
+	asid_assign(as);
+	ehi = faultaddress | (as->as_asid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_VALID;
+	if (*sharep == NULL) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/*
+	 * Entries of other address spaces stay put, so look for a slot
+	 * that is actually invalid before resorting to evicting one.
+	 */
+	i = tlb_probe(ehi, 0);
+	if (i < 0) {
+		for (i=0; i<NUM_TLB; i++) {
+			uint32_t rhi, rlo;
+
+			tlb_read(&rhi, &rlo, i);
+			if (!(rlo & TLBLO_VALID)) {
+				break;
+			}
+		}
+	}
+
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (asid %u)\n",
+	      faultaddress, paddr, as->as_asid);
+	if (i < NUM_TLB) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	tlb_setasid(as->as_asid);
+	splx(spl);
+	return 0;
+}
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	as->as_vbase1 = 0;
+	as->as_pbase1 = 0;
+	as->as_npages1 = 0;
+	as->as_vbase2 = 0;
+	as->as_pbase2 = 0;
+	as->as_npages2 = 0;
+	as->as_stackpbase = 0;
+	as->as_asid = 0;
+	as->as_asidgen = 0;	/* no generation; assigned on first use */
+	as->as_cow1 = NULL;
+	as->as_cow2 = NULL;
+	as->as_cowstack = NULL;
+	as->as_fill1 = NULL;
+	as->as_fill2 = NULL;
+	as->as_fillstack = NULL;
+
+	return as;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	/*
+	 * The ASID is simply abandoned. It won't be handed out again
+	 * until the generation rolls over, which flushes every TLB.
+	 * Shared regions are left to the other sharers.
+	 */
+	if (as->as_cow1 != NULL) {
+		cow_unshare(as->as_cow1);
+	}
+	if (as->as_cow2 != NULL) {
+		cow_unshare(as->as_cow2);
+	}
+	if (as->as_cowstack != NULL) {
+		cow_unshare(as->as_cowstack);
+	}
+	if (as->as_fill1 != NULL) {
+		pagefill_release(as->as_fill1);
+	}
+	if (as->as_fill2 != NULL) {
+		pagefill_release(as->as_fill2);
+	}
+	if (as->as_fillstack != NULL) {
+		pagefill_release(as->as_fillstack);
+	}
+	kfree(as);
+}
+
+void
+as_activate(struct addrspace *as)
+{
+	int spl;
+
+	if (as == NULL) {
+		return;
+	}
+
+	/*
+	 * Nothing to invalidate: entries are tagged with their ASID,
+	 * so just make this address space's ASID the current one.
+	 */
+	spl = splhigh();
+	asid_assign(as);
+	tlb_setasid(as->as_asid);
+	splx(spl);
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	size_t npages;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+	/* We don't use these - all pages are read-write */
+	(void)readable;
+	(void)writeable;
+	(void)executable;
+
+	if (as->as_vbase1 == 0) {
+		as->as_vbase1 = vaddr;
+		as->as_npages1 = npages;
+		return 0;
+	}
+
+	if (as->as_vbase2 == 0) {
+		as->as_vbase2 = vaddr;
+		as->as_npages2 = npages;
+		return 0;
+	}
+
+	/*
+	 * Support for more than two regions is not available.
+	 */
+	kprintf("dumbvm: Warning: too many regions\n");
+	return EUNIMP;
+}
+
+/*
+ * Frames are not zeroed here; each page is zeroed (and filled from
+ * the file, see as_define_backing) by vm_fault when first touched.
+ */
+int
+as_prepare_load(struct addrspace *as)
+{
+	KASSERT(as->as_stackpbase == 0);
+
+	/* Regions from as_map_text already have their frames. */
+	if (as->as_pbase1 == 0) {
+		as->as_pbase1 = getppages(as->as_npages1);
+		if (as->as_pbase1 == 0) {
+			return ENOMEM;
+		}
+		as->as_fill1 = pagefill_create(as->as_vbase1, as->as_npages1);
+		if (as->as_fill1 == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	if (as->as_pbase2 == 0) {
+		as->as_pbase2 = getppages(as->as_npages2);
+		if (as->as_pbase2 == 0) {
+			return ENOMEM;
+		}
+		as->as_fill2 = pagefill_create(as->as_vbase2, as->as_npages2);
+		if (as->as_fill2 == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	if (as->as_stackpbase == 0) {
+		return ENOMEM;
+	}
+	as->as_fillstack = pagefill_create(USERSTACK -
+					   DUMBVM_STACKPAGES * PAGE_SIZE,
+					   DUMBVM_STACKPAGES);
+	if (as->as_fillstack == NULL) {
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * SPB & FAR
+ * Say where the contents of the segment at VADDR come from: FILESZ
+ * bytes of V at OFFSET, the rest zero. Called between as_prepare_load
+ * and as_complete_load in place of reading the segment in; the pages
+ * are read by vm_fault as they are touched. Takes a reference to V.
+ */
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+		  off_t offset, size_t filesz)
+{
+	struct pagefill *pf;
+
+	if ((vaddr & PAGE_FRAME) == as->as_vbase1) {
+		pf = as->as_fill1;
+	}
+	else if ((vaddr & PAGE_FRAME) == as->as_vbase2) {
+		pf = as->as_fill2;
+	}
+	else {
+		return EINVAL;
+	}
+	KASSERT(pf != NULL && pf->pf_vnode == NULL);
+
+	if (vaddr + filesz > pf->pf_vbase + pf->pf_npages * PAGE_SIZE) {
+		return ENOEXEC;
+	}
+
+	VOP_INCREF(v);
+	pf->pf_vnode = v;
+	pf->pf_segvaddr = vaddr;
+	pf->pf_offset = offset;
+	pf->pf_filesz = filesz;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	(void)as;
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	KASSERT(as->as_stackpbase != 0);
+
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+
+	KASSERT(old->as_pbase1 != 0);
+	KASSERT(old->as_pbase2 != 0);
+	KASSERT(old->as_stackpbase != 0);
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	new->as_vbase1 = old->as_vbase1;
+	new->as_npages1 = old->as_npages1;
+	new->as_vbase2 = old->as_vbase2;
+	new->as_npages2 = old->as_npages2;
+
+	/* Share the regions instead of copying them; see cowshare. */
+	new->as_cow1 = cow_share(&old->as_cow1);
+	new->as_cow2 = cow_share(&old->as_cow2);
+	new->as_cowstack = cow_share(&old->as_cowstack);
+	if (new->as_cow1 == NULL || new->as_cow2 == NULL ||
+	    new->as_cowstack == NULL) {
+		as_destroy(new);
+		return ENOMEM;
+	}
+	new->as_pbase1 = old->as_pbase1;
+	new->as_pbase2 = old->as_pbase2;
+	new->as_stackpbase = old->as_stackpbase;
+
+	/* Pages not yet touched get filled for both of us at once. */
+	new->as_fill1 = pagefill_share(old->as_fill1);
+	new->as_fill2 = pagefill_share(old->as_fill2);
+	new->as_fillstack = pagefill_share(old->as_fillstack);
+
+	/*
+	 * OLD may have writeable mappings of what are now shared
+	 * frames; revoke them so its next write faults too.
+	 */
+	asid_retire(old);
+
+	*ret = new;
+	return 0;
+}
+
+/*
+ * SPB & FAR
+ * Take a textshare of the loaded region of AS that starts at VADDR.
+ * The region becomes copy-on-write for AS too. Returns NULL if there
+ * is no such region or we are out of memory.
+ */
+struct textshare *
+as_share_text(struct addrspace *as, vaddr_t vaddr)
+{
+	struct textshare *ts;
+	struct cowshare **sharep;
+	struct pagefill *fill;
+	paddr_t pbase;
+	size_t npages;
+
+	vaddr &= PAGE_FRAME;
+	if (vaddr == as->as_vbase1) {
+		sharep = &as->as_cow1;
+		fill = as->as_fill1;
+		pbase = as->as_pbase1;
+		npages = as->as_npages1;
+	}
+	else if (vaddr == as->as_vbase2) {
+		sharep = &as->as_cow2;
+		fill = as->as_fill2;
+		pbase = as->as_pbase2;
+		npages = as->as_npages2;
+	}
+	else {
+		return NULL;
+	}
+	KASSERT(pbase != 0);
+
+	ts = kmalloc(sizeof(*ts));
+	if (ts == NULL) {
+		return NULL;
+	}
+	ts->ts_cow = cow_share(sharep);
+	if (ts->ts_cow == NULL) {
+		kfree(ts);
+		return NULL;
+	}
+	spinlock_init(&ts->ts_lock);
+	ts->ts_refcount = 1;
+	ts->ts_fill = pagefill_share(fill);	/* text not yet read in */
+	ts->ts_pbase = pbase;
+	ts->ts_npages = npages;
+
+	/* The loader left writeable mappings of the region behind. */
+	asid_retire(as);
+	return ts;
+}
+
+/*
+ * Use TS's frames for the region of AS at VADDR, SZ bytes, in place
+ * of as_define_region; as_prepare_load then leaves the region alone.
+ * Fails if the size doesn't match.
+ */
+int
+as_map_text(struct addrspace *as, vaddr_t vaddr, size_t sz,
+	    struct textshare *ts)
+{
+	struct cowshare *cs;
+	int result;
+
+	result = as_define_region(as, vaddr, sz, 1, 0, 1);
+	if (result) {
+		return result;
+	}
+
+	if (as->as_vbase2 == 0) {
+		if (as->as_npages1 != ts->ts_npages) {
+			return EINVAL;
+		}
+		cs = cow_share(&ts->ts_cow);
+		KASSERT(cs != NULL);	/* ts_cow exists; nothing to allocate */
+		as->as_cow1 = cs;
+		as->as_fill1 = pagefill_share(ts->ts_fill);
+		as->as_pbase1 = ts->ts_pbase;
+	}
+	else {
+		if (as->as_npages2 != ts->ts_npages) {
+			return EINVAL;
+		}
+		cs = cow_share(&ts->ts_cow);
+		KASSERT(cs != NULL);
+		as->as_cow2 = cs;
+		as->as_fill2 = pagefill_share(ts->ts_fill);
+		as->as_pbase2 = ts->ts_pbase;
+	}
+	return 0;
+}
+
+void
+textshare_ref(struct textshare *ts)
+{
+	spinlock_acquire(&ts->ts_lock);
+	ts->ts_refcount++;
+	spinlock_release(&ts->ts_lock);
+}
+
+/*
+ * Drop a reference to TS. Address spaces mapping it keep the frames
+ * through their own cowshare references.
+ */
+void
+textshare_release(struct textshare *ts)
+{
+	bool last;
+
+	spinlock_acquire(&ts->ts_lock);
+	KASSERT(ts->ts_refcount > 0);
+	ts->ts_refcount--;
+	last = (ts->ts_refcount == 0);
+	spinlock_release(&ts->ts_lock);
+
+	if (last) {
+		cow_unshare(ts->ts_cow);
+		if (ts->ts_fill != NULL) {
+			pagefill_release(ts->ts_fill);
+		}
+		spinlock_cleanup(&ts->ts_lock);
+		kfree(ts);
+	}
+}
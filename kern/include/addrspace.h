@@ -0,0 +1,190 @@
+/*
+ * SPB & FAR
+ * Header file for address spaces
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ADDRSPACE_H_
+#define _ADDRSPACE_H_
+
+/*
+ * Address space structure and operations.
+ */
+
+
+#include <vm.h>
+#include "opt-dumbvm.h"
+
+struct vnode;
+struct cowshare;
+struct textshare;
+struct pagefill;
+
+
+/*
+ * Address space - data structure associated with the virtual memory
+ * space of a process.
+ *
+ * You write this.
+ */
+
+struct addrspace {
+#if OPT_DUMBVM
+        vaddr_t as_vbase1;
+        paddr_t as_pbase1;
+        size_t as_npages1;
+        vaddr_t as_vbase2;
+        paddr_t as_pbase2;
+        size_t as_npages2;
+        paddr_t as_stackpbase;
+
+        /*
+         * SPB & FAR
+         * TLB address space ID. Only valid while as_asidgen matches
+         * the allocator's current generation; see dumbvm.c.
+         */
+        unsigned as_asid;
+        unsigned as_asidgen;
+
+        /*
+         * SPB & FAR
+         * Copy-on-write sharing of each region, or NULL while the
+         * region is private; see dumbvm.c.
+         */
+        struct cowshare *as_cow1;
+        struct cowshare *as_cow2;
+        struct cowshare *as_cowstack;
+
+        /*
+         * SPB & FAR
+         * Which pages of each region have been filled in yet, or NULL
+         * once they all have; see dumbvm.c.
+         */
+        struct pagefill *as_fill1;
+        struct pagefill *as_fill2;
+        struct pagefill *as_fillstack;
+#else
+        /* Put stuff here for your VM system */
+#endif
+};
+
+/*
+ * Functions in addrspace.c:
+ *
+ *    as_create - create a new empty address space. You need to make
+ *                sure this gets called in all the right places. You
+ *                may find you want to change the argument list. May
+ *                return NULL on out-of-memory error.
+ *
+ *    as_copy   - create a new address space that is an exact copy of
+ *                an old one. Probably calls as_create to get a new
+ *                empty address space and fill it in, but that's up to
+ *                you.
+ *
+ *    as_activate - make the specified address space the one currently
+ *                "seen" by the processor. Argument might be NULL,
+ *                meaning "no particular address space".
+ *
+ *    as_destroy - dispose of an address space. You may need to change
+ *                the way this works if implementing user-level threads.
+ *
+ *    as_define_region - set up a region of memory within the address
+ *                space.
+ *
+ *    as_prepare_load - this is called before actually loading from an
+ *                executable into the address space.
+ *
+ *    as_complete_load - this is called when loading from an executable
+ *                is complete.
+ *
+ *    as_define_stack - set up the stack region in the address space.
+ *                (Normally called *after* as_complete_load().) Hands
+ *                back the initial stack pointer for the new process.
+ *
+ *    as_define_backing - say which part of a file a segment's contents
+ *                come from, to be read in as its pages are touched.
+ *                Called between as_prepare_load and as_complete_load
+ *                instead of loading the segment.
+ *
+ * Note that when using dumbvm, addrspace.c is not used and these
+ * functions are found in dumbvm.c.
+ */
+
+struct addrspace *as_create(void);
+int               as_copy(struct addrspace *src, struct addrspace **ret);
+void              as_activate(struct addrspace *);
+void              as_destroy(struct addrspace *);
+
+int               as_define_region(struct addrspace *as,
+                                   vaddr_t vaddr, size_t sz,
+                                   int readable,
+                                   int writeable,
+                                   int executable);
+int               as_prepare_load(struct addrspace *as);
+int               as_complete_load(struct addrspace *as);
+int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesz);
+
+/*
+ * SPB & FAR
+ * Shared read-only text:
+ *
+ *    as_share_text - after loading, take a reference to the region
+ *                starting at VADDR so other address spaces can map
+ *                the same frames. NULL on failure.
+ *
+ *    as_map_text - define a region backed by a textshare instead of
+ *                new frames; used in place of as_define_region, and
+ *                the region must then not be loaded.
+ *
+ *    textshare_ref, textshare_release - reference counting.
+ */
+struct textshare *as_share_text(struct addrspace *as, vaddr_t vaddr);
+int               as_map_text(struct addrspace *as, vaddr_t vaddr, size_t sz,
+                              struct textshare *ts);
+void              textshare_ref(struct textshare *ts);
+void              textshare_release(struct textshare *ts);
+
+
+/*
+ * Functions in loadelf.c
+ *    load_elf - load an ELF user program executable into the current
+ *               address space. Returns the entry point (initial PC)
+ *               in the space pointed to by ENTRYPOINT.
+ *
+ *    elfcache_invalidate - drop any cached headers for V; call before
+ *               V's contents change.
+ */
+
+int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void elfcache_invalidate(struct vnode *v);
+
+
+#endif /* _ADDRSPACE_H_ */
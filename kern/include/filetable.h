@@ -9,18 +9,28 @@
 #define FILETABLE_H_
 
 #include <limits.h>
+#include <spinlock.h>
 
 
 ///////////////////////////////////////
 //Filetable Struct
+//One per process (p_ft), shared after fork until either side changes
+//it: whoever does first gets a private copy. Kernel-only processes
+//have none. While shared (ft_refcount > 1) nobody changes ftarr, so
+//it can be read without a lock; the table owns one reference on each
+//openfile in it.
 struct filetable{
 	struct openfile *ftarr[OPEN_MAX];
-	int index;
+	int ft_refcount;//processes using it
+	struct spinlock ft_lock;//protects ft_refcount
 };
 
 int filetable_init(void);
-int add_filehandle(struct openfile* ofile);
-struct filetable filetable_create(void);
-struct openfile* filetable_copy(void);
+int add_filehandle(struct openfile* ofile, int *fdret);
+struct filetable *filetable_create(void);
+struct filetable *filetable_share(void);
+void filetable_release(struct filetable *ft);
+struct filetable *filetable_own(void);
+struct openfile *filetable_get(int fd);
 
 #endif /* FILETABLE_H_ */
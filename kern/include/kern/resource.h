@@ -0,0 +1,27 @@
+/*
+ * SPB & FAR
+ * Resource usage, as returned by getrusage.
+ * Shared with userland.
+ */
+
+#ifndef _KERN_RESOURCE_H_
+#define _KERN_RESOURCE_H_
+
+/* Which usage getrusage reports */
+#define RUSAGE_SELF      0	/* the calling process */
+#define RUSAGE_CHILDREN  (-1)	/* its children that have been waited for */
+
+/* Call numbers counted in ru_nsyscalls; higher ones aren't counted */
+#define RU_NSYSCALLS     128
+
+struct rusage {
+	uint32_t ru_ticks;		/* hardclocks spent running */
+	uint32_t ru_nvcsw;		/* voluntary context switches */
+	uint32_t ru_nivcsw;		/* involuntary (preempted) ones */
+	uint32_t ru_faults;		/* page faults */
+	uint64_t ru_inbytes;		/* bytes moved by read */
+	uint64_t ru_outbytes;		/* bytes moved by write */
+	uint32_t ru_nsyscalls[RU_NSYSCALLS];	/* calls by number */
+};
+
+#endif /* _KERN_RESOURCE_H_ */
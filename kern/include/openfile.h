@@ -19,5 +19,7 @@ struct openfile{
 };
 
 int openfile_init(struct vnode* vn, int mode, struct openfile* ofile);
+void openfile_decref(struct openfile* ofile);
+void openfile_incref(struct openfile* ofile);
 
 #endif /* OPENFILE_H_ */
@@ -7,23 +7,53 @@
 #ifndef _PROCESS_H_
 #define _PROCESS_H_
 
-#define MAX_RUNNING_PROCS 256//TODO may need change this value.
+#include <rusage.h>
+#include <spinlock.h>
 
-//global array for holding all active processes.
-extern struct process* ptable[];
+struct filetable;
+
+//The process table grows on demand, up to PID_MAX; see proc_syscalls.c.
+
+//List of processes, linked through p_nextsib/p_prevsib
+struct proclist {
+	struct process *pl_head;
+	struct process *pl_tail;
+};
 
 //Process structure
 struct process {
   pid_t parent_pid;
-	struct cv *waitcv;//still not sure what this will be used for
-	struct lock *lk_proc;
-	int exited;
+	struct cv *waitcv;//waitpid sleeps here; our children's exits signal it
+	volatile int exited;//set last in exit; see proc_family_lk
 	int exitcode;
 	struct thread* self;
+	pid_t p_pid;
+
+	//Family links; these and exited/exitcode are protected by
+	//proc_family_lk (proc_syscalls.c)
+	struct process *p_parent;//NULL once orphaned
+	struct proclist p_children;//children still running
+	struct proclist p_zombies;//exited children not yet waited for, oldest first
+	struct spinlock p_zlock;//also held to change p_zombies; waitpid's fast path takes only this
+	struct process *p_nextsib;//link on p_parent's p_children or p_zombies
+	struct process *p_prevsib;
+
+	struct filetable *p_ft;//open files, maybe shared (filetable.h); NULL if none
+
+	//Resource usage. While we run ours is in self->t_ru; p_ru gets it
+	//at exit, before exited is set, for the parent to collect.
+	struct kusage p_ru;
+	struct kusage p_cru;//children (and theirs) that have been waited for; only we touch it
 };
 
 //Function that will malloc the struct and set it's fields accordingly.
-int process_init(struct thread* t); //allocates memory, sets up fields, calls add_process.
+int process_init(struct thread* t, bool child); //allocates memory, sets up fields, calls add_process.
 pid_t add_process(struct process* proc); //adds the process to the global process table.
+struct process *proc_get(pid_t pid); //O(1) lookup; NULL if PID isn't in use.
+void proc_set(pid_t pid, struct process *proc); //stores PROC (or NULL) at an allocated PID.
+pid_t pid_alloc(void); //O(1); hands out the PID that has been free longest.
+void proc_addchild(struct process *parent, struct process *child); //O(1)
+void proc_exit(int exitcode); //exit bookkeeping for curthread's process; frees it if orphaned.
+void pid_free(pid_t pid); //O(1); PID goes to the back of the free ring.
 #endif /* _PROCESS_H_ */ 
 
@@ -0,0 +1,42 @@
+/*
+ * runqueue.h
+ * SPB & FAR
+ * Per-cpu run queue: one threadlist per priority level plus a bitmap
+ * of the levels that are nonempty, so that adding a thread and
+ * picking the next one to run are both constant time no matter how
+ * many threads are runnable.
+ *
+ * Level 0 is the highest priority. Threads are queued at the level
+ * given by their t_priority and are FIFO within a level.
+ */
+
+#ifndef _RUNQUEUE_H_
+#define _RUNQUEUE_H_
+
+#include <threadlist.h>
+
+#define RUNQ_LEVELS	32	/* one bit each in rq_bitmap */
+
+struct runqueue {
+	uint32_t rq_bitmap;		/* bit N set iff rq_lists[N] nonempty */
+	unsigned rq_count;		/* total number of queued threads */
+	struct threadlist rq_lists[RUNQ_LEVELS];
+};
+
+void runqueue_init(struct runqueue *rq);
+void runqueue_cleanup(struct runqueue *rq);
+bool runqueue_isempty(struct runqueue *rq);
+
+/* Add T at the tail of its priority level. */
+void runqueue_add(struct runqueue *rq, struct thread *t);
+
+/* Remove the first thread of the highest nonempty level, or NULL. */
+struct thread *runqueue_remhead(struct runqueue *rq);
+
+/* Remove the last thread of the lowest nonempty level, or NULL. */
+struct thread *runqueue_remtail(struct runqueue *rq);
+
+/* Remove T, which must be on RQ, from wherever it is. */
+void runqueue_remove(struct runqueue *rq, struct thread *t);
+
+#endif /* _RUNQUEUE_H_ */
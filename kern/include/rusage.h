@@ -0,0 +1,35 @@
+/*
+ * rusage.h
+ * SPB & FAR
+ * Kernel-side resource usage counts.
+ */
+
+#ifndef _RUSAGE_H_
+#define _RUSAGE_H_
+
+#include <kern/resource.h>
+
+/*
+ * The same counts as struct rusage (<kern/resource.h>), except that the
+ * per-call counts are a separate RU_NSYSCALLS block, allocated at the
+ * first system call. Kernel threads never make one, so they don't carry
+ * the block around.
+ */
+struct kusage {
+	uint32_t ru_ticks;
+	uint32_t ru_nvcsw;
+	uint32_t ru_nivcsw;
+	uint32_t ru_faults;
+	uint64_t ru_inbytes;
+	uint64_t ru_outbytes;
+	uint32_t *ru_nsyscalls;		/* NULL until there is something in it */
+};
+
+void kusage_init(struct kusage *ku);
+void kusage_cleanup(struct kusage *ku);
+void kusage_syscall(struct kusage *ku, int callno);
+void kusage_add(struct kusage *dst, const struct kusage *src);
+void kusage_move(struct kusage *dst, struct kusage *src);
+int kusage_copyout(const struct kusage *ku, struct rusage *usage);
+
+#endif /* _RUSAGE_H_ */
@@ -0,0 +1,75 @@
+/*
+ * swtrace.h
+ * SPB & FAR
+ * Per-cpu context switch trace buffer.
+ *
+ * Every cpu owns a ring of SWTRACE_SIZE records that is filled from
+ * thread_switch, thread_make_runnable and wchan_sleep. Records are
+ * only ever written by the owning cpu with interrupts off, so the
+ * producer side needs no locks; the oldest records are overwritten.
+ */
+
+#ifndef _SWTRACE_H_
+#define _SWTRACE_H_
+
+#include <thread.h>
+
+#define SWTRACE_SIZE	256	/* records per cpu; must be power of 2 */
+#define SWTRACE_NAMELEN	16	/* bytes of wchan name kept per record */
+
+/* Event types */
+#define SWT_SWITCH	0	/* thread_switch: from -> to */
+#define SWT_READY	1	/* thread_make_runnable: to became runnable */
+#define SWT_SLEEP	2	/* wchan_sleep: from going to sleep */
+
+/*
+ * One trace record. Threads are recorded by pointer and pid; the
+ * pointers are only printed, never followed, since the thread may be
+ * long gone by the time the buffer is dumped. For the same reason the
+ * wchan name is copied rather than pointed to.
+ */
+struct swtrace_rec {
+	uint32_t sr_seq;		/* per-cpu event number */
+	uint32_t sr_time;		/* c_hardclocks at the event */
+	uint8_t sr_event;		/* SWT_* */
+	uint8_t sr_state;		/* new threadstate_t */
+	const struct thread *sr_from;	/* outgoing thread */
+	const struct thread *sr_to;	/* incoming thread */
+	pid_t sr_frompid;
+	pid_t sr_topid;
+	char sr_wchan[SWTRACE_NAMELEN];	/* wchan slept on; empty unless S_SLEEP */
+};
+
+struct swtrace {
+	volatile uint32_t st_next;	/* seq of the next record */
+	unsigned st_cpunum;		/* owning cpu */
+	struct swtrace *st_link;	/* all trace buffers, for dumping */
+	struct swtrace_rec st_recs[SWTRACE_SIZE];
+};
+
+/* Global on/off switch, checked inline at every trace point. */
+extern volatile bool swtrace_enabled;
+
+struct swtrace *swtrace_create(unsigned cpunum);
+void swtrace_record(unsigned event, struct thread *from, struct thread *to,
+		    threadstate_t state, const char *wchan);
+
+/*
+ * Trace point. Costs one load and branch when tracing is off.
+ * Must be called with interrupts off on the current cpu.
+ */
+#define SWTRACE(ev, from, to, st, wc) \
+	do { \
+		if (swtrace_enabled) { \
+			swtrace_record(ev, from, to, st, wc); \
+		} \
+	} while (0)
+
+/*
+ * Menu command: swt [on|off|dump|save [file]]
+ * "save" writes the buffers as text to a host file through emufs
+ * (default emu0:swtrace.txt) for offline analysis.
+ */
+int swtracecmd(int nargs, char **args);
+
+#endif /* _SWTRACE_H_ */
@@ -35,6 +35,21 @@
 
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct rusage; /* from <kern/resource.h> */
+
+/*
+ * SPB & FAR
+ * spawn has no number among the standard calls in <kern/syscall.h>;
+ * userland's call list has to use the same one.
+ */
+#ifndef SYS_spawn
+#define SYS_spawn 120
+#endif
+
+/* Likewise getrusage. */
+#ifndef SYS_getrusage
+#define SYS_getrusage 121
+#endif
 
 /*
  * The system call dispatcher.
@@ -46,6 +61,7 @@ void syscall(struct trapframe *tf);
 //Support Functions
 
 void enter_forked_process(void* data1, unsigned long ul);
+void enter_spawned_process(void* data1, unsigned long ul);
 
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
@@ -73,11 +89,13 @@ int sys___getcwd(char *buf, size_t buflen, int *retv);
 /////////////////////////////////
 //Prototypes for PROC SYSCALLS
 int sys_fork(struct trapframe* ptf,int *retv);
+int sys_spawn(const char* path, char** argv, const int* fdmap, int nfds, int *retv);
 int sys_execv(const char* argc, char** argv, int *retv);
 int sys_getpid(int *retv);
 int sys__exit(int u_exitcode, int *retv);
 int sys_waitpid(int pid, int *status, int options, int *retv);
 int ksys_waitpid(int pid, int *status, int options, int *retv);
+int sys_getrusage(int who, struct rusage *usage, int *retv);
 
 
 
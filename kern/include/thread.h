@@ -40,7 +40,9 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <runqueue.h>
 #include <filetable.h>//TODO SPB FAR
+#include <rusage.h>
 
 struct addrspace;
 struct cpu;
@@ -68,6 +70,29 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/* Scheduling classes. SPB FAR */
+typedef enum {
+	SCHED_NORMAL,	/* FIFO time-sharing, c_runqueue */
+	SCHED_EDF,	/* earliest-deadline-first real-time, c_rtqueue */
+} schedclass_t;
+
+/*
+ * EDF utilization is tracked in fixed point: a thread with budget B
+ * per period P uses B*RT_UTIL_SCALE/P. Admission control refuses to
+ * let the real-time class take more than RT_UTIL_MAX of a cpu so
+ * normal threads are never starved outright.
+ */
+#define RT_UTIL_SCALE	1000
+#define RT_UTIL_MAX	900
+
+/*
+ * Priorities of normal-class threads; these index the run queue
+ * levels in runqueue.h, so smaller numbers run first.
+ */
+#define PRI_HIGHEST	0
+#define PRI_LOWEST	(RUNQ_LEVELS - 1)
+#define PRI_DEFAULT	(RUNQ_LEVELS / 2)
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -76,6 +101,7 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -116,8 +142,30 @@ struct thread {
 
 	/* add more here as needed */
 	/* SPB FAR edits here. */
-	struct openfile* filetable[OPEN_MAX];
-	pid_t pid;
+	pid_t pid;			/* process; open files are in its p_ft */
+
+	/*
+	 * Resource usage of this thread's process so far. Only ever
+	 * updated by the thread itself (on its own cpu, for ticks), so
+	 * it needs no lock.
+	 */
+	struct kusage t_ru;
+
+	bool t_pinned;			/* never migrated off t_cpu */
+
+	/*
+	 * Real-time scheduling. All times are in hardclocks of t_cpu.
+	 * Protected by t_cpu's runqueue lock.
+	 */
+	schedclass_t t_class;		/* Scheduling class */
+	unsigned t_priority;		/* Run queue level, PRI_* */
+	unsigned t_rt_period;		/* Length of one period */
+	unsigned t_rt_budget;		/* Runtime allowed per period */
+	unsigned t_rt_used;		/* Runtime used in this period */
+	unsigned t_rt_deadline;		/* End of the current period */
+	bool t_rt_throttled;		/* Out of budget until t_rt_deadline */
+	unsigned t_rt_misses;		/* # of deadlines missed */
+	unsigned t_rt_overruns;		/* # of times budget ran out */
 };
 
 /* Call once during system startup to allocate data structures. */
@@ -140,11 +188,30 @@ void thread_shutdown(void);
  * handed back. (Note that using said thread structure from the parent
  * thread should be done only with caution, because in general the
  * child thread might exit at any time.) Returns an error code.
+ *
+ * The new thread's process has no parent and is freed when it exits.
+ * thread_fork_child instead makes it a child of the caller's process,
+ * to be collected with waitpid, and hands back its PID rather than the
+ * thread; fork and spawn use that.
  */
 int thread_fork(const char *name, 
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2, 
                 struct thread **ret);
+int thread_fork_child(const char *name,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2,
+                      pid_t *childpid);
+
+/*
+ * Like thread_fork, but for per-cpu service threads: the new thread
+ * belongs to cpu C rather than the current one, runs at priority PRI,
+ * and is never migrated. Panics if out of memory; meant for startup.
+ */
+struct thread *thread_fork_pinned(const char *name, struct cpu *c,
+                                  unsigned pri,
+                                  void (*func)(void *, unsigned long),
+                                  void *data1, unsigned long data2);
 
 /*
  * Cause the current thread to exit.
@@ -159,6 +226,19 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Directed yield: like thread_yield, but run TARGET next. Used to hand
+ * the cpu to a lock holder instead of going to sleep behind it.
+ *
+ * The caller must hold INTERLOCK, and holding it must keep TARGET from
+ * being destroyed (e.g. the spinlock protecting a lock's owner field).
+ * If TARGET can be run next (it is waiting on this cpu's run queue and
+ * both threads are SCHED_NORMAL), INTERLOCK is released, we switch,
+ * and true is returned; INTERLOCK is not reacquired. Otherwise nothing
+ * happens, INTERLOCK is still held, and false is returned.
+ */
+bool thread_yield_to(struct thread *target, struct spinlock *interlock);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -170,5 +250,44 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Address space activation with per-cpu caching (see c_curas).
+ *
+ * thread_as_activate loads AS into the current cpu's MMU unless it is
+ * already the one loaded there; use it instead of calling as_activate
+ * directly. thread_as_forget must be called before as_destroy so no
+ * cpu goes on believing a dead address space is loaded, and whenever
+ * what the MMU holds for AS goes stale (e.g. its ASID is retired).
+ * thread_as_stats sums the activation counters over all cpus; the
+ * swtrace dump reports them.
+ */
+void thread_as_activate(struct addrspace *as);
+void thread_as_forget(struct addrspace *as);
+void thread_as_stats(unsigned *activations, unsigned *skipped);
+
+/*
+ * Set the current thread's normal-class priority, PRI_HIGHEST through
+ * PRI_LOWEST. Takes effect the next time it's queued. New threads
+ * inherit the priority of the thread that forked them.
+ */
+void thread_setpriority(unsigned pri);
+
+/*
+ * Earliest-deadline-first real-time class.
+ *
+ * thread_edf_set puts the current thread in the EDF class with the
+ * given period and per-period budget (both in hardclocks), pinning it
+ * to the current cpu. Fails with EINVAL for a nonsensical budget and
+ * EBUSY if admitting it would push the cpu past RT_UTIL_MAX.
+ *
+ * thread_edf_clear returns the current thread to the normal class.
+ *
+ * thread_edf_yield ends the current thread's job for this period; it
+ * sleeps until its next period starts.
+ */
+int thread_edf_set(unsigned period, unsigned budget);
+void thread_edf_clear(void);
+void thread_edf_yield(void);
+
 
 #endif /* _THREAD_H_ */
@@ -0,0 +1,67 @@
+/*
+ * workqueue.h
+ * SPB & FAR
+ * Deferred work.
+ *
+ * Something that wants work done later, off its own path, embeds a
+ * struct work, sets it up once with work_init, and queues it. Each cpu
+ * has a worker thread that runs the items queued on that cpu in order,
+ * in thread context: they may sleep, take locks, do I/O.
+ *
+ *    work_queue - run W soon on the current cpu. May be called from
+ *                an interrupt handler. Returns false (and does nothing)
+ *                if W was already queued and hasn't started running.
+ *
+ *    work_queue_on - same, on cpu C.
+ *
+ *    work_queue_delayed - run W on the current cpu once TICKS more
+ *                hardclocks have gone by. Also interrupt-safe.
+ *
+ *    work_cancel - take W off its queue if it hasn't started running;
+ *                returns true if it was. Does not wait for a run that
+ *                is already under way; follow with work_flush for that.
+ *
+ *    work_flush - wait until W is neither queued nor running. Sleeps.
+ *
+ * An item queued again while it runs runs again afterwards. W must
+ * stay allocated while queued or running; the function may free it.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <spinlock.h>
+
+struct cpu;
+struct workqueue;
+
+typedef void (*work_func_t)(void *data1, unsigned long data2);
+
+struct work {
+	spinlock_data_t w_pending;	/* set from queueing until it runs */
+	struct work *w_next;		/* on wq_head or wq_delayed */
+	struct workqueue *w_queue;	/* queue it's on, or NULL */
+	struct workqueue *w_lastq;	/* queue it was last put on */
+	unsigned w_expires;		/* hardclock when delayed work is due */
+	work_func_t w_func;
+	void *w_data1;
+	unsigned long w_data2;
+};
+
+void work_init(struct work *w, work_func_t func,
+	       void *data1, unsigned long data2);
+bool work_queue(struct work *w);
+bool work_queue_on(struct cpu *c, struct work *w);
+bool work_queue_delayed(struct work *w, unsigned ticks);
+bool work_cancel(struct work *w);
+void work_flush(struct work *w);
+
+/*
+ * For the thread system: workqueue_start creates cpu C's queue and
+ * worker; workqueue_tick is called on each hardclock of the current
+ * cpu, with interrupts off, to release delayed work that is due.
+ */
+void workqueue_start(struct cpu *c);
+void workqueue_tick(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -36,6 +36,7 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
@@ -172,6 +173,8 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	struct thread *owner;
+
 	spinlock_acquire(&lock->lk_spinlock);
 	if(lock_do_i_hold(lock))//we don't already have acquired it!
 	{
@@ -182,6 +185,19 @@ lock_acquire(struct lock *lock)
 	{
 		while(lock->lk_owner != NULL)
 		{
+			//If the owner is waiting on our own run queue, donate the
+			//rest of our time to it so it can get out of the critical
+			//section, rather than sleeping behind it. The owner can't
+			//go away while we hold lk_spinlock. If the handoff can't
+			//happen (e.g. either of us is real-time), sleep as usual.
+			owner = lock->lk_owner;
+			if(owner->t_state == S_READY && owner->t_cpu == curcpu->c_self &&
+			   thread_yield_to(owner, &lock->lk_spinlock))
+			{
+				spinlock_acquire(&lock->lk_spinlock);
+				continue;
+			}
+
 			wchan_lock(lock->lk_wchan);
 			spinlock_release(&lock->lk_spinlock);
 			wchan_sleep(lock->lk_wchan);
@@ -49,6 +49,9 @@ int sys_open(const char *filepath, int flags, int *retv){
 	if (err)
 		return err;
 
+	if(flags & O_TRUNC)
+		elfcache_invalidate(vn);//truncated; cached exec headers are stale
+
 	//After successful vfs_open...
 
 	struct openfile *ofile;
@@ -57,22 +60,22 @@ int sys_open(const char *filepath, int flags, int *retv){
 		err = ENOMEM;
 		goto fail;
 	}
-	*retv = add_filehandle(ofile);
-	if(*retv == -1){
-		err = EMFILE;
-		goto fail1;
-	}
 
 	err = openfile_init(vn, flags, ofile);
 	if (err)//check for err upon ofile init.
+		goto fail1;
+
+	err = add_filehandle(ofile, retv);
+	if(err)//table full, or no memory to stop sharing it
 		goto fail2;
-	
+
 	return 0;
 fail2:
-	vfs_close(vn);
+	lock_destroy(ofile->vnode_lock);
 fail1:
 	kfree(ofile);
 fail:
+	vfs_close(vn);
 	return err;
 }
 
@@ -81,36 +84,23 @@ fail:
  * On success, close returns 0. On error an errNO is returned
  */
 int sys_close(int fd, int* retv){
-	struct lock *lkptr;
-	int flag = 0;
-
-	if(fd < 0 || fd >= OPEN_MAX){
-		return EBADF;
-	}
+	struct filetable *ft;
 
-	if(curthread->filetable[fd]==NULL){
+	if(filetable_get(fd)==NULL){
 		*retv = -1;
 		return EBADF;
 	}
 
-	struct openfile* ofile = curthread->filetable[fd];
-	lock_acquire(ofile->vnode_lock);
-	lkptr = ofile->vnode_lock;
-	ofile->refcount--;
-
-	if(ofile->refcount == 0){
-		vfs_close(ofile->vn_ptr);
-		kfree(ofile);
-		flag = 1;
+	ft = filetable_own();//stop sharing it with parent/child first
+	if(ft == NULL){
+		*retv = -1;
+		return ENOMEM;
 	}
 
-
-	curthread->filetable[fd] = NULL;
+	struct openfile* ofile = ft->ftarr[fd];
+	ft->ftarr[fd] = NULL;
+	openfile_decref(ofile);
 	*retv = 0;
-	lock_release(lkptr);
-	if(flag ==1){
-		lock_destroy(lkptr);
-	}
 	return 0;//success
 }
 
@@ -126,11 +116,10 @@ int sys_read(int fd, void *buf, size_t buflen, int *retv)
 	struct uio userio;
 	err = 0;
 
-	if(fd < 0 || fd >= OPEN_MAX || curthread->filetable[fd]==NULL)
+	struct openfile* ofile = filetable_get(fd);
+	if(ofile == NULL)
 		return EBADF;
 
-	struct openfile* ofile = curthread->filetable[fd];
-
 	lock_acquire(ofile->vnode_lock);
 
 	if(ofile->mode == O_WRONLY){  //fd does not exist, or file is not open for reading.
@@ -146,6 +135,7 @@ int sys_read(int fd, void *buf, size_t buflen, int *retv)
 	}
 
 	numbytes = buflen - userio.uio_resid; //calculate number of bytes read.
+	curthread->t_ru.ru_inbytes += numbytes;
 	if(err){
 		lock_release(ofile->vnode_lock);
 		return err;
@@ -169,10 +159,10 @@ int sys_write(int fd, const void *buf, size_t nbytes, int *retv)
 	struct uio userio;
 	//char* kbuf = (char*)kmalloc(nbytes);
 
-	if(fd < 0 || fd >= OPEN_MAX || curthread->filetable[fd]==NULL)
+	struct openfile* ofile = filetable_get(fd);//gets ofile
+	if(ofile == NULL)
 		return EBADF;
 
-	struct openfile* ofile = curthread->filetable[fd];//gets ofile
 	lock_acquire(ofile->vnode_lock);
 	if(ofile->mode == O_RDONLY){  //fd does not exist, or file is not open for reading.
 		lock_release(ofile->vnode_lock);
@@ -181,7 +171,12 @@ int sys_write(int fd, const void *buf, size_t nbytes, int *retv)
 
 	uio_uinit(&iov, &userio, (userptr_t)buf, nbytes, ofile->offset, UIO_WRITE);  //TODO Might need to user our uio_uinit() function here.
 
+	//Any cached exec headers are stale: drop them before, so no exec
+	//starts from them meanwhile, and after, in case an exec read the
+	//old headers while we were writing.
+	elfcache_invalidate(ofile->vn_ptr);
 	err = VOP_WRITE(ofile->vn_ptr, &userio); //Does the actual reading
+	elfcache_invalidate(ofile->vn_ptr);
 	if(err){
 		lock_release(ofile->vnode_lock);
 		return err;
@@ -189,6 +184,7 @@ int sys_write(int fd, const void *buf, size_t nbytes, int *retv)
 	numbytes = nbytes - userio.uio_resid;  //calculate bytes read
 	ofile->offset = userio.uio_offset;
 	lock_release(ofile->vnode_lock);
+	curthread->t_ru.ru_outbytes += numbytes;
 	*retv = numbytes;
 	return 0; //SUCCESS!
 }
@@ -212,10 +208,10 @@ int sys_lseek(int fd, off_t pos, int whence, off_t* lsret)
 	int err = 0;
 	off_t temp = 0;
 
-	if(fd < 0 || fd >= OPEN_MAX || curthread->filetable[fd]==NULL) //checks to make sure fd is a valid file handle.
+	ofile = filetable_get(fd);  //gets ofile
+	if(ofile == NULL) //checks to make sure fd is a valid file handle.
 		return EBADF;
 
-	ofile = curthread->filetable[fd];  //gets ofile
 	lock_acquire(ofile->vnode_lock);   //gets lock
 
 	switch(whence){
@@ -239,7 +235,7 @@ int sys_lseek(int fd, off_t pos, int whence, off_t* lsret)
 		break;
 
 		case SEEK_END: //SEEK_END, the new position is the position of end-of-file plus pos. 
-			err = VOP_STAT(curthread->filetable[fd]->vn_ptr, &fstat);
+			err = VOP_STAT(ofile->vn_ptr, &fstat);
 			if(err){
 				lock_release(ofile->vnode_lock);
 				return err;
@@ -270,10 +266,10 @@ int sys_lseek(int fd, off_t pos, int whence, off_t* lsret)
  */
 int sys_dup2(int oldfd, int newfd, int* retv)
 {
-	int err = 0;
+	struct filetable *ft;
 
 	//Both filehandles must be non-negative, less than OPEN_MAX and oldfd must be a valid file handle.
-	if(oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX || curthread->filetable[oldfd]==NULL)
+	if(newfd < 0 || newfd >= OPEN_MAX || filetable_get(oldfd)==NULL)
 		return EBADF;
 
 	if(oldfd == newfd){ //No need to process a dup of the same fd.. Return 0 to act as if it worked :)
@@ -281,20 +277,20 @@ int sys_dup2(int oldfd, int newfd, int* retv)
 		return 0;
 	}
 
-	//If newfd names an open file, that file is closed.
-	if(curthread->filetable[newfd] != NULL){
-		err = sys_close(newfd, retv);
-		if(err)//TODO SHOULD NEVER be true  SINCE ONLY CHECK IS FOR NULL at [newfd]
-			return err;
-	}
+	ft = filetable_own();//stop sharing it with parent/child first
+	if(ft == NULL)
+		return ENOMEM;
 
 	//clones the file handle oldfd onto the file handle newfd
-	struct openfile* dup_ofile = curthread->filetable[oldfd];
-	lock_acquire(dup_ofile->vnode_lock);
-	curthread->filetable[newfd] = dup_ofile;
-	curthread->filetable[newfd]->refcount++; // adding a ref to ofile.
+	struct openfile* dup_ofile = ft->ftarr[oldfd];
+	openfile_incref(dup_ofile); // adding a ref to ofile.
+
+	//If newfd names an open file, that file is closed.
+	if(ft->ftarr[newfd] != NULL)
+		openfile_decref(ft->ftarr[newfd]);
+
+	ft->ftarr[newfd] = dup_ofile;
 	*retv = newfd;
-	lock_release(dup_ofile->vnode_lock);
 	return 0;
 }
 
@@ -4,6 +4,11 @@
  * filetable helper functions
  *   1) filetable_init
  * 	2) add_filehandle
+ * 	3) filetable_create
+ * 	4) filetable_share
+ * 	5) filetable_release
+ * 	6) filetable_own
+ * 	7) filetable_get
  */
 #include <types.h>
 #include <kern/errno.h>
@@ -22,18 +27,25 @@
 #include <synch.h>
 #include <filetable.h>
 #include <openfile.h>
+#include <process.h>
 
 
 
 /*
  * filetable_init
  * initializes a filetable with stdin, stdout, stderr defaults at 0,1,2
+ * creating the current process's table first if it has none
  *
  * Returns 0 on success, error code on failure
  */
 int filetable_init(){
 	int err;
 	char con1[5] = "con:";
+	struct filetable *ft;
+
+	ft = filetable_own();
+	if (ft == NULL)
+		return ENOMEM;
 
 	struct vnode *vn1, *vn2, *vn3;
 
@@ -52,7 +64,7 @@ int filetable_init(){
 	if(err)//check for err upon ofile init.
 		return err;
 
-	curthread->filetable[0] = ofile1;
+	ft->ftarr[0] = ofile1;
 
 	strcpy(con1, "con:"); //reinitilize con
 	/////////////////////////////////////////////
@@ -70,7 +82,7 @@ int filetable_init(){
 	if(err)//check for err upon ofile init.
 		return err;
 
-	curthread->filetable[1] = ofile2;
+	ft->ftarr[1] = ofile2;
 
 	strcpy(con1, "con:"); //reinitilize con
 	/////////////////////////////////////////////
@@ -88,31 +100,157 @@ int filetable_init(){
 	if(err)//check for err upon ofile init.
 		return err;
 
-	curthread->filetable[2] = ofile3;
+	ft->ftarr[2] = ofile3;
 
 	return 0; 
 }
 
 /**
  * add_filehandle
- * finds the next NULL entry in the filetable
+ * finds the next NULL entry in the current process's filetable
  * sets the ofile to this entry
  * 
  * ON SUCCESS:
- * return the index where we stored the of_ptr.
+ * return 0 and set *fdret to the index where we stored the of_ptr.
  *
  * ON FAILURE:
- * set err
+ * return EMFILE if the table is full, ENOMEM if it couldn't be copied
  */
-int add_filehandle(struct openfile* ofile)
+int add_filehandle(struct openfile* ofile, int *fdret)
 {
+	struct filetable *ft = filetable_own();
+
+	if(ft == NULL)
+		return ENOMEM;
+
 	for(int fd=3; fd<OPEN_MAX; fd++)
 	{
-		if(curthread->filetable[fd] == NULL)
+		if(ft->ftarr[fd] == NULL)
+		{
+			ft->ftarr[fd] = ofile;
+			*fdret = fd;
+			return 0;
+		}
+	}
+	return EMFILE; // if this function reaches this line then the file table is full!
+}
+
+/**
+ * filetable_create
+ * Allocates an empty filetable with one reference.
+ * Returns NULL if out of memory.
+ */
+struct filetable *filetable_create(void)
+{
+	struct filetable *ft = kmalloc(sizeof(struct filetable));
+
+	if(ft == NULL)
+		return NULL;
+	for(int fd=0; fd<OPEN_MAX; fd++)
+		ft->ftarr[fd] = NULL;
+	ft->ft_refcount = 1;
+	spinlock_init(&ft->ft_lock);
+	return ft;
+}
+
+/**
+ * filetable_share
+ * Returns the current process's filetable with a reference taken,
+ * for a child to use as its own (fork). O(1): the entries are only
+ * copied if and when one side changes them. NULL if there is none.
+ */
+struct filetable *filetable_share(void)
+{
+	struct filetable *ft = proc_get(curthread->pid)->p_ft;
+
+	if(ft == NULL)
+		return NULL;
+	spinlock_acquire(&ft->ft_lock);
+	ft->ft_refcount++;
+	spinlock_release(&ft->ft_lock);
+	return ft;
+}
+
+/**
+ * filetable_release
+ * Drops one reference to FT; the last one closes every file in it and
+ * frees it. FT may be NULL.
+ */
+void filetable_release(struct filetable *ft)
+{
+	bool last;
+
+	if(ft == NULL)
+		return;
+
+	spinlock_acquire(&ft->ft_lock);
+	KASSERT(ft->ft_refcount > 0);
+	ft->ft_refcount--;
+	last = (ft->ft_refcount == 0);
+	spinlock_release(&ft->ft_lock);
+	if(!last)
+		return;
+
+	for(int fd=0; fd<OPEN_MAX; fd++)
+	{
+		if(ft->ftarr[fd] != NULL)
+			openfile_decref(ft->ftarr[fd]);
+	}
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+/**
+ * filetable_own
+ * Returns the current process's filetable, ready to be changed: if it
+ * is still shared with another process we switch to a copy of it
+ * first, and if there is none yet we get an empty one.
+ * Returns NULL if out of memory, leaving the old table in place.
+ */
+struct filetable *filetable_own(void)
+{
+	struct process *me = proc_get(curthread->pid);
+	struct filetable *ft = me->p_ft;
+	struct filetable *copy;
+	bool shared;
+
+	if(ft != NULL)
+	{
+		//a count of 1 is ours alone and nobody else can raise it
+		spinlock_acquire(&ft->ft_lock);
+		shared = (ft->ft_refcount > 1);
+		spinlock_release(&ft->ft_lock);
+		if(!shared)
+			return ft;
+	}
+
+	copy = filetable_create();
+	if(copy == NULL)
+		return NULL;
+	if(ft != NULL)
+	{
+		for(int fd=0; fd<OPEN_MAX; fd++)
 		{
-			curthread->filetable[fd] = ofile;
-			return fd;
+			copy->ftarr[fd] = ft->ftarr[fd];
+			if(copy->ftarr[fd] != NULL)
+				openfile_incref(copy->ftarr[fd]);
 		}
+		filetable_release(ft);
 	}
-	return -1; // if this function reaches this line then the file table is full!
+	me->p_ft = copy;
+	return copy;
+}
+
+/**
+ * filetable_get
+ * Returns the current process's openfile for FD, or NULL if FD is out
+ * of range or not open. Needs no lock: see struct filetable.
+ */
+struct openfile *filetable_get(int fd)
+{
+	struct filetable *ft = proc_get(curthread->pid)->p_ft;
+
+	if(fd < 0 || fd >= OPEN_MAX || ft == NULL)
+		return NULL;
+	return ft->ftarr[fd];
 }
@@ -0,0 +1,489 @@
+/*
+ * SPB & FAR
+ * ELF executable loader, with a cache of parsed headers
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Code to load an ELF-format executable into the current address space.
+ *
+ * It makes the following address space calls:
+ *    - first, as_define_region once for each segment of the program;
+ *    - then, as_prepare_load;
+ *    - then as_define_backing for each segment, which the VM system
+ *      reads in a page at a time as the program touches it;
+ *    - finally, as_complete_load.
+ *
+ * This gives the VM code enough flexibility to deal with even grossly
+ * mis-linked executables if that proves desirable. Under normal
+ * circumstances, as_prepare_load and as_complete_load probably don't
+ * need to do anything.
+ *
+ * If you wanted to support memory-mapped executables you would need
+ * to rearrange this to map each segment.
+ *
+ * To support dynamically linked executables with shared libraries
+ * you'd need to change this to load the "ELF interpreter" (dynamic
+ * linker). And you'd have to write a dynamic linker...
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vnode.h>
+#include <elf.h>
+
+/*
+ * SPB & FAR
+ * What load_elf needs out of an executable's headers: the entry point
+ * and its loadable segments. At most ELF_MAXSEGS of them; dumbvm only
+ * takes two regions anyway.
+ */
+#define ELF_MAXSEGS 8
+
+struct elfseg {
+	off_t es_offset;	/* where the segment starts in the file */
+	vaddr_t es_vaddr;
+	size_t es_memsz;
+	size_t es_filesz;
+	uint32_t es_flags;	/* PF_R, PF_W, PF_X */
+	struct textshare *es_text;	/* loaded frames if read-only, or NULL */
+};
+
+struct elfimage {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elfseg ei_segs[ELF_MAXSEGS];
+};
+
+/*
+ * SPB & FAR
+ * Cache of parsed executables, keyed by vnode, so that exec'ing the
+ * same binary again skips reading and checking its headers. Each entry
+ * holds a vnode reference, so a cached vnode can't be recycled for
+ * another file while it is here; the least recently used entry is
+ * dropped to make room.
+ *
+ * Entries also keep the loaded frames of each read-only segment (see
+ * as_share_text), so every process running the program maps the same
+ * text instead of reading its own copy.
+ *
+ * Writing to a file (or truncating it on open) calls elfcache_invalidate.
+ * elfcache_gen counts invalidations, so a load_elf that parsed the
+ * headers while a write was going on doesn't put them in afterwards.
+ * Only invalidations that can matter count: ones that find an entry,
+ * or that happen while some miss is being parsed (elfcache_parsers).
+ * Console and data-file writes with the cache warm leave it alone.
+ */
+#define ELFCACHE_SIZE 8
+
+struct elfcache_entry {
+	struct vnode *ec_vnode;		/* NULL if the slot is free */
+	unsigned ec_lastuse;
+	struct elfimage ec_image;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;		/* for ec_lastuse */
+static unsigned elfcache_gen;
+static unsigned elfcache_parsers;	/* misses not yet inserted or dropped */
+
+/*
+ * Drop the textshare references held by IMG.
+ */
+static
+void
+elfimage_release(struct elfimage *img)
+{
+	unsigned i;
+
+	for (i=0; i<img->ei_nsegs; i++) {
+		if (img->ei_segs[i].es_text != NULL) {
+			textshare_release(img->ei_segs[i].es_text);
+			img->ei_segs[i].es_text = NULL;
+		}
+	}
+}
+
+/*
+ * Look V up in the cache. On a hit, copy its image to IMG, with a
+ * reference to each textshare for the caller to release, and return
+ * true. Either way *GEN gets the generation to hand to elfcache_insert.
+ * A miss counts as a parse in progress until the caller either calls
+ * elfcache_insert or elfcache_giveup.
+ */
+static
+bool
+elfcache_lookup(struct vnode *v, struct elfimage *img, unsigned *gen)
+{
+	unsigned i, j;
+	bool found = false;
+
+	spinlock_acquire(&elfcache_lock);
+	*gen = elfcache_gen;
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			elfcache[i].ec_lastuse = ++elfcache_clock;
+			*img = elfcache[i].ec_image;
+			for (j=0; j<img->ei_nsegs; j++) {
+				if (img->ei_segs[j].es_text != NULL) {
+					textshare_ref(img->ei_segs[j].es_text);
+				}
+			}
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		elfcache_parsers++;
+	}
+	spinlock_release(&elfcache_lock);
+	return found;
+}
+
+/*
+ * A miss from elfcache_lookup that won't be inserted after all.
+ */
+static
+void
+elfcache_giveup(void)
+{
+	spinlock_acquire(&elfcache_lock);
+	KASSERT(elfcache_parsers > 0);
+	elfcache_parsers--;
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Remember V's parsed image, unless the file was written since GEN
+ * was read. Evicts the least recently used entry if the cache is full.
+ * Takes over IMG's textshare references either way.
+ */
+static
+void
+elfcache_insert(struct vnode *v, struct elfimage *img, unsigned gen)
+{
+	struct vnode *evicted = NULL;
+	struct elfimage evictedimg;
+	unsigned i, victim = 0;
+
+	VOP_INCREF(v);
+
+	spinlock_acquire(&elfcache_lock);
+	KASSERT(elfcache_parsers > 0);
+	elfcache_parsers--;
+	if (gen != elfcache_gen) {
+		spinlock_release(&elfcache_lock);
+		elfimage_release(img);
+		VOP_DECREF(v);
+		return;
+	}
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			/* someone else got here first */
+			spinlock_release(&elfcache_lock);
+			elfimage_release(img);
+			VOP_DECREF(v);
+			return;
+		}
+		if (elfcache[i].ec_vnode == NULL) {
+			victim = i;
+			break;
+		}
+		if (elfcache[i].ec_lastuse < elfcache[victim].ec_lastuse) {
+			victim = i;
+		}
+	}
+	evicted = elfcache[victim].ec_vnode;
+	evictedimg = elfcache[victim].ec_image;
+	elfcache[victim].ec_vnode = v;
+	elfcache[victim].ec_lastuse = ++elfcache_clock;
+	elfcache[victim].ec_image = *img;
+	spinlock_release(&elfcache_lock);
+
+	/* may go to the filesystem; not under the spinlock */
+	if (evicted != NULL) {
+		elfimage_release(&evictedimg);
+		VOP_DECREF(evicted);
+	}
+}
+
+/*
+ * Forget whatever the cache knows about V. Called after V's contents
+ * change, and may also be called before, so nobody starts from the
+ * old headers meanwhile.
+ */
+void
+elfcache_invalidate(struct vnode *v)
+{
+	struct vnode *evicted = NULL;
+	struct elfimage evictedimg;
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			evicted = v;
+			evictedimg = elfcache[i].ec_image;
+			elfcache[i].ec_vnode = NULL;
+			break;
+		}
+	}
+	/* a parse under way might have read V's old contents */
+	if (evicted != NULL || elfcache_parsers > 0) {
+		elfcache_gen++;
+	}
+	spinlock_release(&elfcache_lock);
+
+	/* processes already running the old text keep their frames */
+	if (evicted != NULL) {
+		elfimage_release(&evictedimg);
+		VOP_DECREF(evicted);
+	}
+}
+
+/*
+ * SPB & FAR
+ * Read and check V's executable and program headers, filling IMG.
+ * This is the part of loading that the cache lets repeated execs skip.
+ */
+static
+int
+elf_parse(struct vnode *v, struct elfimage *img)
+{
+	Elf_Ehdr eh;   /* Executable header */
+	Elf_Phdr ph;   /* "Program header" = segment header */
+	int result, i;
+	struct iovec iov;
+	struct uio ku;
+
+	/*
+	 * Read the executable header from offset 0 in the file.
+	 */
+
+	uio_kinit(&iov, &ku, &eh, sizeof(eh), 0, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on header - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	/*
+	 * Check to make sure it's a 32-bit ELF-version-1 executable
+	 * for our processor type. If it's not, we can't run it.
+	 *
+	 * Ignore ELF_OSABI - one could then run executables for
+	 * other operating systems, but that is left as an exercise.
+	 */
+
+	if (eh.e_ident[ELF_MAG0] != ELFMAG0 ||
+	    eh.e_ident[ELF_MAG1] != ELFMAG1 ||
+	    eh.e_ident[ELF_MAG2] != ELFMAG2 ||
+	    eh.e_ident[ELF_MAG3] != ELFMAG3 ||
+	    eh.e_ident[ELF_CLASS] != ELFCLASS32 ||
+	    eh.e_ident[ELF_DATA] != ELFDATA2MSB ||
+	    eh.e_ident[ELF_VERSION] != EV_CURRENT ||
+	    eh.e_version != EV_CURRENT ||
+	    eh.e_type!=ET_EXEC ||
+	    eh.e_machine!=EM_MACHINE) {
+		return ENOEXEC;
+	}
+
+	/*
+	 * Go through the list of segments and remember the loadable ones.
+	 *
+	 * Ordinarily there will be one code segment, one read-only
+	 * data segment, and one data/bss segment, but there might
+	 * conceivably be more.
+	 *
+	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
+	 * mandated by the ELF standard - we use sizeof(ph) to load,
+	 * because that's the structure we know, but the file on disk
+	 * might have a larger structure, so we must use e_phentsize
+	 * to find where the phdr starts.
+	 */
+
+	img->ei_entry = eh.e_entry;
+	img->ei_nsegs = 0;
+	for (i=0; i<eh.e_phnum; i++) {
+		off_t offset = eh.e_phoff + i*eh.e_phentsize;
+		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+
+		result = VOP_READ(v, &ku);
+		if (result) {
+			return result;
+		}
+
+		if (ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("ELF: short read on phdr - file truncated?\n");
+			return ENOEXEC;
+		}
+
+		switch (ph.p_type) {
+		    case PT_NULL: /* skip */ continue;
+		    case PT_PHDR: /* skip */ continue;
+		    case PT_MIPS_REGINFO: /* skip */ continue;
+		    case PT_LOAD: break;
+		    default:
+			kprintf("loadelf: unknown segment type %d\n",
+				ph.p_type);
+			return ENOEXEC;
+		}
+
+		if (img->ei_nsegs == ELF_MAXSEGS) {
+			kprintf("loadelf: more than %d segments\n",
+				ELF_MAXSEGS);
+			return ENOEXEC;
+		}
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+		img->ei_segs[img->ei_nsegs].es_offset = ph.p_offset;
+		img->ei_segs[img->ei_nsegs].es_vaddr = ph.p_vaddr;
+		img->ei_segs[img->ei_nsegs].es_memsz = ph.p_memsz;
+		img->ei_segs[img->ei_nsegs].es_filesz = ph.p_filesz;
+		img->ei_segs[img->ei_nsegs].es_flags = ph.p_flags;
+		img->ei_segs[img->ei_nsegs].es_text = NULL;
+		img->ei_nsegs++;
+	}
+
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elfimage img;
+	struct elfseg *seg;
+	unsigned gen, i;
+	bool cached;
+	int result;
+	struct addrspace *as;
+
+	as = curthread->t_addrspace;
+
+	cached = elfcache_lookup(v, &img, &gen);
+	if (!cached) {
+		result = elf_parse(v, &img);
+		if (result) {
+			elfcache_giveup();
+			return result;
+		}
+	}
+
+	/*
+	 * Set up the address space. Text we already have loaded is
+	 * mapped rather than given fresh frames.
+	 */
+
+	for (i=0; i<img.ei_nsegs; i++) {
+		seg = &img.ei_segs[i];
+		if (seg->es_text != NULL) {
+			result = as_map_text(as, seg->es_vaddr, seg->es_memsz,
+					     seg->es_text);
+		}
+		else {
+			result = as_define_region(as,
+						  seg->es_vaddr, seg->es_memsz,
+						  seg->es_flags & PF_R,
+						  seg->es_flags & PF_W,
+						  seg->es_flags & PF_X);
+		}
+		if (result) {
+			goto done;
+		}
+	}
+
+	result = as_prepare_load(as);
+	if (result) {
+		goto done;
+	}
+
+	/*
+	 * Now say where each segment comes from. Nothing is read here;
+	 * pages are faulted in from V on first access, and whatever
+	 * lies past the file contents (BSS) is zero-filled then.
+	 */
+
+	for (i=0; i<img.ei_nsegs; i++) {
+		seg = &img.ei_segs[i];
+		if (seg->es_text != NULL) {
+			continue;
+		}
+		result = as_define_backing(as, seg->es_vaddr, v,
+					   seg->es_offset, seg->es_filesz);
+		if (result) {
+			goto done;
+		}
+	}
+
+	result = as_complete_load(as);
+	if (result) {
+		goto done;
+	}
+
+	*entrypoint = img.ei_entry;
+
+	if (!cached) {
+		/* Keep the freshly loaded text for the next exec. */
+		for (i=0; i<img.ei_nsegs; i++) {
+			seg = &img.ei_segs[i];
+			if (!(seg->es_flags & PF_W)) {
+				seg->es_text = as_share_text(as, seg->es_vaddr);
+			}
+		}
+		elfcache_insert(v, &img, gen);
+		return 0;
+	}
+
+ done:
+	if (!cached) {
+		elfcache_giveup();
+	}
+	/* our address space holds its own references to mapped text */
+	elfimage_release(&img);
+	return result;
+}
@@ -3,13 +3,17 @@
  * SPB & FAR
  * Helper function for openfile struct
  *   1) openfile_init()
+ *   2) openfile_decref()
+ *   3) openfile_incref()
  * 
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <lib.h>
 #include <synch.h>
+#include <vfs.h>
 #include <openfile.h>
 
 /**
@@ -32,3 +36,33 @@ int openfile_init(struct vnode* vn, int mode, struct openfile* ofile){
 
 	return 0;
 }
+
+/**
+ * Drops one reference to ofile, closing it when it was the last.
+ * Same as what sys_close does for an fd, for callers holding an
+ * openfile that is not in any filetable.
+ */
+void openfile_decref(struct openfile* ofile){
+	struct lock *lkptr = ofile->vnode_lock;
+	int last;
+
+	lock_acquire(lkptr);
+	ofile->refcount--;
+	last = (ofile->refcount == 0);
+	if(last){
+		vfs_close(ofile->vn_ptr);
+		kfree(ofile);
+	}
+	lock_release(lkptr);
+	if(last)
+		lock_destroy(lkptr);
+}
+
+/**
+ * Takes another reference to ofile, for a new filetable entry.
+ */
+void openfile_incref(struct openfile* ofile){
+	lock_acquire(ofile->vnode_lock);
+	ofile->refcount++;
+	lock_release(ofile->vnode_lock);
+}
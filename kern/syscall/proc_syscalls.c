@@ -8,14 +8,35 @@
  * 	4) sys_getpid
  * 	5) sys_execv
  * 	6) sys_fork
+ * 	7) sys_spawn
+ * 	8) sys_getrusage
  *
  * 	Proc Sysceall Helper functions
  * 	1) enter_forked_process
  * 	2) process_init
  * 	3) add_process
+ * 	4) pid_alloc
+ * 	5) pid_free
+ * 	6) proc_addchild
+ * 	7) proc_orphan_children
+ * 	8) proc_waitchild
+ * 	9) proc_reap
+ * 	10) execv_copyinargs
+ * 	11) execv_load
+ * 	12) enter_spawned_process
+ * 	13) proc_snapshot_files
+ * 	14) kusage_init
+ * 	15) kusage_cleanup
+ * 	16) kusage_syscall
+ * 	17) kusage_add
+ * 	18) kusage_move
+ * 	19) kusage_copyout
+ * 	20) proc_exit
+ * 	21) proc_collect
  */
 
 #include <types.h>
+#include <limits.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <kern/wait.h>
@@ -38,48 +59,257 @@
 #include "filetable.h"
 #include "openfile.h"
 #include "process.h"
+#include "rusage.h"
 
 
-struct process* ptable[MAX_RUNNING_PROCS];
+/*
+ * Process table: a two-level PID -> process map. The top level is a
+ * fixed array covering PID_MIN..PID_MAX; leaf chunks of PTABLE_CHUNK
+ * slots are only allocated as the PID space grows. Chunks are never
+ * freed, so proc_get can read without a lock.
+ */
+#define PTABLE_CHUNK 256
+#define PTABLE_NCHUNKS DIVROUNDUP(PID_MAX + 1, PTABLE_CHUNK)
+
+static struct process **ptable[PTABLE_NCHUNKS];
+
+/*
+ * Free PIDs, kept as a FIFO ring. Allocating takes the oldest free PID
+ * and freeing puts it at the back, so both are O(1), and a PID that
+ * was just released is the last one to be handed out again: it sits
+ * out every other free PID first. That keeps a stale waitpid from
+ * landing on some unrelated new process.
+ *
+ * The PID space, pid_limit, only grows (by a chunk at a time) when
+ * every PID in it is in use, so the table and the ring stay sized to
+ * the most processes there have been at once rather than to PID_MAX.
+ */
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static pid_t *pid_ring;
+static unsigned pid_ringsize;	/* capacity of pid_ring */
+static unsigned pid_head;	/* next PID to hand out */
+static unsigned pid_nfree;
+static volatile pid_t pid_limit = PID_MIN;	/* PIDs in use are below this */
+
+/*
+ * Protects the family links of every process (p_parent, p_children,
+ * p_zombies and the sibling links) along with exited and exitcode.
+ * A single lock, because exit and waitpid each touch two processes,
+ * and per-process locks would need an order to take them in. It's a
+ * sleep lock so waitpid can cv_wait on it. Created with the first
+ * process.
+ *
+ * The one exception is waitpid for a child that has already exited,
+ * which takes no sleep lock: exit sets exited last, after a barrier
+ * (release), and waitpid reads it before a barrier (acquire), so
+ * seeing it set means seeing the exit code, usage and zombie-list
+ * link that went before. Only the parent takes a child off its
+ * lists, so that child can't go anywhere in between; p_zlock covers
+ * the zombie list against siblings exiting at the same time.
+ */
+static struct lock *proc_family_lk;
+
+/*
+ * Full memory barrier: MIPS sync orders the loads and stores before
+ * it against the ones after, and the clobber keeps the compiler from
+ * moving them across it.
+ */
+#define PROC_MEMBAR() __asm volatile("sync" : : : "memory")
+
+/*
+ * Exec argument arena: execv and spawn stream arguments straight into
+ * it and copy it to the new user stack with one copyout. There is just
+ * one, ARG_MAX bytes, allocated on first use and kept, since dumbvm
+ * never gives back multi-page allocations. execargs_lk is held from
+ * copy-in until the image has been copied out, and for nothing else:
+ * execv_load opens and loads the program first, without it, so execs
+ * only queue up behind each other's argument copies, not their I/O.
+ * Created with the first process.
+ */
+static struct lock *execargs_lk;
+static char *execargs_arena;
+
+static void proc_orphan_children(struct process *parent);
+static void proc_reap(struct process *proc);
+static void proc_snapshot_files(struct filetable *ft, const int *fdmap, int nfds);
+static void proclist_addtail(struct proclist *pl, struct process *proc);
+static void proclist_remove(struct proclist *pl, struct process *proc);
+static void proc_collect(struct process *me, struct process *child);
 
 /**
  * sys__exit
- * sets the exit code for exiting process, resets parent pid child processes
+ * sets the exit code for exiting process, queues it for the parent's
+ * waitpid, resets parent pid child processes
  */
 int sys__exit(int u_exitcode, int *retv)
 {
-	lock_acquire(ptable[curthread->pid]->lk_proc);
-
-	u_exitcode = _MKWAIT_EXIT(u_exitcode);
-	ptable[curthread->pid]->exitcode = u_exitcode;
-	ptable[curthread->pid]->exited = 1;//Sets the exit flag
-	for(int pid=0; pid < MAX_RUNNING_PROCS; pid++){
-		if(ptable[pid] == NULL){
-			//Intentionally SKIP
-		}
-		else if( ptable[pid]->parent_pid == curthread->pid ){
-			ptable[pid]->parent_pid = -1;//Sets PPID to invalid number
-		}
-	}
+	proc_exit(u_exitcode);
 
 	*retv = 0;
-	cv_broadcast(ptable[curthread->pid]->waitcv, ptable[curthread->pid]->lk_proc);
-	lock_release(ptable[curthread->pid]->lk_proc);
 	thread_exit();
 	return 0;
 }
 
+/**
+ * proc_exit
+ * Exit bookkeeping for the current thread's process. Queues it for the
+ * parent's waitpid, or, if there is no parent left to wait, frees it
+ * right here: nobody else ever would. Children are orphaned and the
+ * ones that already exited are freed the same way, so orphans never
+ * hold on to their struct process or PID.
+ * Called from sys__exit, and again (as a no-op) from thread_exit,
+ * which also covers threads that never went through sys__exit.
+ */
+void proc_exit(int exitcode)
+{
+	struct process *me;
+	struct process *parent;
+
+	if(curthread->pid < 0)
+		return;//been here already
+	me = proc_get(curthread->pid);
+	KASSERT(me != NULL && me->self == curthread);
+
+	//close our files now rather than whenever we get reaped
+	filetable_release(me->p_ft);
+	me->p_ft = NULL;
+
+	lock_acquire(proc_family_lk);
+
+	me->exitcode = _MKWAIT_EXIT(exitcode);
+	kusage_move(&me->p_ru, &curthread->t_ru);//final usage, for the parent to collect
+	proc_orphan_children(me);//Sets children's PPID to invalid
+
+	//Move over to the parent's zombie list, in exit order, and wake
+	//the parent. Exactly one wakeup per exit.
+	parent = me->p_parent;
+	if(parent != NULL){
+		proclist_remove(&parent->p_children, me);
+		spinlock_acquire(&parent->p_zlock);
+		proclist_addtail(&parent->p_zombies, me);
+		spinlock_release(&parent->p_zlock);
+		cv_signal(parent->waitcv, proc_family_lk);
+	}
+
+	//Publish the exit last (release); from here on the parent may
+	//collect and free ME without the lock, so don't touch it again.
+	PROC_MEMBAR();
+	me->exited = 1;
+
+	lock_release(proc_family_lk);
+
+	//once reaped our PID can be handed out again; don't look it up
+	curthread->pid = -1;
+	if(parent == NULL)
+		proc_reap(me);//orphan; nobody will wait for us
+}
+
+/**
+ * proc_waitchild
+ * Common part of sys_waitpid and ksys_waitpid. Waits for child PID of
+ * the current process to exit, or for any child if PID is -1, and
+ * takes it out of the family. Children are collected in the order
+ * they exited. With WNOHANG, never sleeps; *RET is NULL if no
+ * suitable child has exited yet.
+ */
+static int proc_waitchild(pid_t pid, int options, struct process **ret){
+    struct process *me = proc_get(curthread->pid);
+    struct process *child;
+
+    *ret = NULL;
+    if((options & ~WNOHANG) != 0)
+        return EINVAL;
+    if(pid != -1 && pid < PID_MIN)
+        return ESRCH;//no process groups
+
+    //Fast path: that child has already exited. Once it's seen to be
+    //ours it stays put, since only we take children off our lists.
+    //Someone else's process can be reaped under us, though: proc_reap
+    //clears the slot before freeing, so if the slot still holds CHILD
+    //after we've looked, what we saw wasn't freed memory.
+    if(pid != -1){
+        child = proc_get(pid);
+        if(child != NULL && child->p_parent == me &&
+           child->p_pid == pid && child->exited){
+            PROC_MEMBAR();//acquire; pairs with the one in proc_exit
+            if(proc_get(pid) != child)
+                goto slow;//reaped meanwhile; it wasn't ours
+            proc_collect(me, child);
+            *ret = child;
+            return 0;
+        }
+    }
+
+ slow:
+    lock_acquire(proc_family_lk);
+    while(1){
+        if(pid == -1){
+            if(me->p_children.pl_head == NULL &&
+               me->p_zombies.pl_head == NULL){
+                lock_release(proc_family_lk);
+                return ECHILD;
+            }
+            child = me->p_zombies.pl_head;
+        }else{
+            child = proc_get(pid);
+            if(child == NULL){
+                lock_release(proc_family_lk);
+                return ESRCH;
+            }
+            if(child->p_parent != me){
+                lock_release(proc_family_lk);
+                return ECHILD;
+            }
+            if(!child->exited)
+                child = NULL;
+        }
+
+        if(child != NULL || (options & WNOHANG))
+            break;
+        cv_wait(me->waitcv, proc_family_lk);//Signalled from child exiting
+    }
+
+    if(child != NULL)
+        proc_collect(me, child);
+    lock_release(proc_family_lk);
+
+    *ret = child;
+    return 0;
+}
+
+/**
+ * proc_reap
+ * Frees an exited process that has been taken out of the family, and
+ * its PID. The slot is cleared first, so that anyone looking it up
+ * without proc_family_lk (waitpid's fast path) either gets NULL or
+ * sees the slot change under them before the memory goes away.
+ */
+static void proc_reap(struct process *proc){
+    pid_t pid = proc->p_pid;
+
+    KASSERT(proc->exited);
+    KASSERT(proc->p_parent == NULL);
+    KASSERT(proc->p_ft == NULL);
+
+    proc_set(pid, NULL);
+    PROC_MEMBAR();//slot cleared before the memory is reused
+
+    spinlock_cleanup(&proc->p_zlock);
+    kusage_cleanup(&proc->p_ru);
+    kusage_cleanup(&proc->p_cru);
+    cv_destroy(proc->waitcv);
+    kfree(proc);
+    pid_free(pid);
+}
+
 /**
  * sys_waitpid
+ * PID may be -1 for any child; OPTIONS may be WNOHANG.
  */
 int sys_waitpid(int pid, int *status, int options, int *retv){
-    (void)options;
+    struct process *child;
+    int exitcode;
     int err;
-    //Make sure pid is a valid pid
-    if(pid >= MAX_RUNNING_PROCS || pid < 0 || ptable[pid]==NULL ){
-        *retv = -1;
-        return ESRCH;
-    }
 
     if(status == NULL){
         *retv = -1;
@@ -97,36 +327,26 @@ int sys_waitpid(int pid, int *status, int options, int *retv){
         return EFAULT;
     }
 
-    if (options != 0 ){
-        *retv = -1;
-        return EINVAL;
-    }
-
-    if(curthread->pid != ptable[pid]->parent_pid){
+    err = proc_waitchild(pid, options, &child);
+    if(err){
         *retv = -1;
-        return ECHILD;
+        return err;
     }
 
-    if(ptable[pid]->exited == 0){
-        lock_acquire(ptable[pid]->lk_proc);
-        cv_wait(ptable[pid]->waitcv, ptable[pid]->lk_proc);
+    if(child == NULL){//WNOHANG and nobody has exited
+        *retv = 0;
+        return 0;
     }
 
-    //Signalled from child exiting
-    *retv = pid;
+    *retv = child->p_pid;
+    exitcode = child->exitcode;
+    proc_reap(child);
 
-    err = copyout((const void*)&(ptable[pid]->exitcode), (userptr_t) status, sizeof(ptable[pid]->exitcode));
+    err = copyout((const void*)&exitcode, (userptr_t) status, sizeof(exitcode));
     if (err){
         *retv = -1;
         return err;
     }
-
-    lock_release(ptable[pid]->lk_proc);
-
-    cv_destroy(ptable[pid]->waitcv);
-    lock_destroy(ptable[pid]->lk_proc);
-    kfree(ptable[pid]);
-    ptable[pid] = NULL;
     return 0;
 }
 
@@ -135,37 +355,46 @@ int sys_waitpid(int pid, int *status, int options, int *retv){
  * Used to wait pid's when called from kernel space
  */
 int ksys_waitpid(int pid, int *status, int options, int *retv){
-	if(pid >= MAX_RUNNING_PROCS || pid < 0 || ptable[pid]==NULL ){
-	        *retv = -1;
-	        return ESRCH;
-	}
-    if (options != 0 ){//|| options != WNOHANG || options != WUNTRACED){
-        *retv = -1;
-        return EINVAL;
-    }
+    struct process *child;
+    int err;
 
-    if(curthread->pid != ptable[pid]->parent_pid){
+    err = proc_waitchild(pid, options, &child);
+    if(err){
         *retv = -1;
-        return ECHILD;
+        return err;
     }
 
-    if(ptable[pid]->exited == 0){
-        lock_acquire(ptable[pid]->lk_proc);
-        cv_wait(ptable[pid]->waitcv, ptable[pid]->lk_proc);
+    if(child == NULL){//WNOHANG and nobody has exited
+        *retv = 0;
+        return 0;
     }
 
-    //Signalled from child exiting
-    *retv = pid;
-
-    status = (int*) ptable[pid]->exitcode;
-    lock_release(ptable[pid]->lk_proc);
-    cv_destroy(ptable[pid]->waitcv);
-    lock_destroy(ptable[pid]->lk_proc);
-    kfree(ptable[pid]);
-    ptable[pid] = NULL;
+    *retv = child->p_pid;
+    if(status != NULL)
+        *status = child->exitcode;
+    proc_reap(child);
     return 0;
+}
+/**
+ * sys_getrusage
+ * Copies out the resource usage of the calling process (RUSAGE_SELF)
+ * or of its children that have been waited for (RUSAGE_CHILDREN).
+ */
+int sys_getrusage(int who, struct rusage *usage, int *retv){
+	const struct kusage *ku;
+
+	if(who == RUSAGE_SELF){
+		ku = &curthread->t_ru;
+	}else if(who == RUSAGE_CHILDREN){
+		ku = &proc_get(curthread->pid)->p_cru;
+	}else{
+		return EINVAL;
+	}
 
+	*retv = 0;
+	return kusage_copyout(ku, usage);
 }
+
 /**
  * sys_getpid
  * returns pid for curthread
@@ -176,85 +405,94 @@ int sys_getpid(int *retv){
 }
 
 /**
- * sys_execv
+ * execv_copyinargs
+ * Streams a user argv into the exec argument arena, leaving it holding
+ * the image that goes on the new user stack: argn+1 pointers (offsets
+ * into the image until execv_load relocates them) followed by the
+ * strings, each padded to 4 bytes. The whole image is bounded by
+ * ARG_MAX and nothing else; E2BIG past that.
+ * Called from execv_load with execargs_lk held and the old address
+ * space (the one ARGV is in) active.
  */
-int sys_execv(const char* argc, char** argv, int *retv)
+static int execv_copyinargs(char** argv, int *argnp, int *lenp)
 {
-    int err=0;
-    size_t gotv;
-
-    char** kbuf = (char**)kmalloc(128*sizeof(char*));
+    int err;
+    size_t got;
+    size_t off = 0;//end of the strings copied so far
+    int argn = 0;
+
+    KASSERT(lock_do_i_hold(execargs_lk));
+    if(execargs_arena == NULL){
+        execargs_arena = kmalloc(ARG_MAX);
+        if(execargs_arena == NULL)
+            return ENOMEM;
+    }
 
-    int i = 0;
-    while(1){//copy in pointers
-    	err = copyin((userptr_t)&(argv[i]), &(kbuf[i]), sizeof(char*));
+    //strings go in back to back from the start; their pointers are
+    //only counted here and written once we know how many there are
+    while(1){
+        char* uarg;
+        err = copyin((const_userptr_t)&(argv[argn]), &uarg, sizeof(char*));
         if(err)
             return err;
-        if(kbuf[i] == NULL)
+        if(uarg == NULL)
             break;
-        i++;
-    }
 
-    int argn = i;
-    //total number of padded indexes needed
-    //aligned by 4 for pointers
-    int padLen = (argn + 1)*4;
-    char* kargv[128];
-    for (int i = 0; i < argn; i++){
-        kargv[i] = (char*)kmalloc(PATH_MAX);
-        bzero(kargv[i], PATH_MAX);
-        err = copyinstr((userptr_t)kbuf[i], kargv[i], PATH_MAX, &gotv);
-        if (err)
+        //room for this pointer and the terminating NULL besides the strings
+        size_t reserve = (argn + 2)*sizeof(char*);
+        if(off + reserve >= ARG_MAX)
+            return E2BIG;
+        err = copyinstr((const_userptr_t)uarg, execargs_arena + off, ARG_MAX - reserve - off, &got);
+        if(err == ENAMETOOLONG)
+            return E2BIG;
+        if(err)
             return err;
 
-        int t = 0;
-        int modint = (strlen(kargv[i])+1)%4;//find remainder to allow for padding
-        if(modint != 0)
-            modint = 4 - modint;//padding finalized to align by 4
-
-        // each arg string will be:
-        // 1 for default null terminator +
-        // size of actually argument +
-        // padding necessary to align by 4
-        t = strlen(kargv[i]) + 1 + modint;
-        padLen = padLen + t;
+        //pad to 4; off and reserve stay aligned so this still fits
+        bzero(execargs_arena + off + got, ROUNDUP(got, 4) - got);
+        off += ROUNDUP(got, 4);
+        argn++;
     }
 
+    //slide the strings up past the pointer array and point at them
+    size_t ptrlen = (argn + 1)*sizeof(char*);
+    memmove(execargs_arena + ptrlen, execargs_arena, off);
 
-    char kargvp[padLen];
-    bzero(kargvp, padLen);
-
-    int off = (argn+1)*4;
-    for(int i = 0; i<argn+1;i++){
-        if(i == argn){//copy null pointer to last pointer
-            ((char**)kargvp)[i] = NULL;
-        }else{ // strcopy argument from its offset location
-            ((char**)kargvp)[i] = (char*)off;
-            strcpy(&(kargvp[off]), kargv[i]);
-
-            int len = strlen(kargv[i])+1;
-            if (len % 4 != 0) {
-                len += 4 - (len % 4);
-            }
-            off += len;//adjust offset
-        }
+    char** kargv = (char**)execargs_arena;
+    size_t str = ptrlen;
+    for(int i = 0; i<argn; i++){
+        kargv[i] = (char*)str;
+        str += ROUNDUP(strlen(execargs_arena + str) + 1, 4);
     }
+    kargv[argn] = NULL;
 
-    char progname[PATH_MAX];
-    size_t got;
-
-    err = copyinstr((userptr_t)argc, progname, PATH_MAX,&got);
-    if(err != 0)
-        return err;
-
-    //handles empty progname error
-    if(got == 1)
-        return EINVAL;
+    *argnp = argn;
+    *lenp = ptrlen + off;
+    return 0;
+}
 
+/**
+ * execv_load
+ * Builds a fresh address space holding progname with the user argv
+ * ARGV (from the current address space) packed on its stack; the
+ * argument count goes in *argnp. The parent's address space is never
+ * copied. The program is loaded first, and only then are the arguments
+ * moved through the arena, so execargs_lk is only held for that.
+ * ON SUCCESS: curthread runs on the new address space, and the one it
+ * 		had before is handed back in *old_asp for the caller to destroy
+ * 		(execv) or switch back to (spawn).
+ * ON ERROR: the new address space is destroyed and curthread is back
+ * 		on its old one.
+ */
+static int execv_load(const char* progname, char** argv, int *argnp,
+		struct addrspace **old_asp, vaddr_t *entryp, vaddr_t *stackp)
+{
+    int err;
+    int argn, padLen;
     struct vnode *v;
 
     /* Open the executable. */
-    err = vfs_open(progname, O_RDONLY, 0, &v);
+    err = vfs_open((char*)progname, O_RDONLY, 0, &v);
     if (err)
         return err;
 
@@ -265,40 +503,95 @@ int sys_execv(const char* argc, char** argv, int *retv)
         return ENOMEM;
     }
 
-    /* Activate it. */
-    as_activate(new_as);
+    /* Switch to it and activate it. */
     struct addrspace* old_as = curthread->t_addrspace;
     curthread->t_addrspace = new_as;
+    thread_as_activate(new_as);
 
     /* Load the executable. */
     vaddr_t entrypoint, stackptr;
     err = load_elf(v, &entrypoint);
-    if (err) {
-        vfs_close(v);
-        curthread->t_addrspace = old_as;
-        return err;
-    }
-    as_destroy(old_as);
+    vfs_close(v);/* Definitely Done with the file now.*/
+    if (err)
+        goto fail;
 
     // COPY ARGUMENTS INTO USER STACK
     /* Define the user stack in the address space */
-    err = as_define_stack(curthread->t_addrspace, &stackptr);
-    if (err) {
-        return err;
+    err = as_define_stack(new_as, &stackptr);
+    if (err)
+        goto fail;
+
+    //ARGV is in the old image; switching is just a reload of EntryHi
+    curthread->t_addrspace = old_as;
+    thread_as_activate(old_as);
+    lock_acquire(execargs_lk);
+    err = execv_copyinargs(argv, &argn, &padLen);
+    curthread->t_addrspace = new_as;
+    thread_as_activate(new_as);
+    if(err == 0){
+        char** kargvp = (char**)execargs_arena;
+
+        stackptr -= padLen;
+        for (int i = 0; i < argn; i++) {
+            kargvp[i] += stackptr;
+        }
+        err = copyout(kargvp, (userptr_t)stackptr, padLen);
     }
-    stackptr -= padLen;
+    lock_release(execargs_lk);
+    if(err)
+        goto fail;
+
+    *argnp = argn;
+    *old_asp = old_as;
+    *entryp = entrypoint;
+    *stackp = stackptr;
+    return 0;
+
+ fail:
+    //go back to the old image; the MMU has new_as's mappings loaded
+    curthread->t_addrspace = old_as;
+    thread_as_activate(old_as);
+    thread_as_forget(new_as);
+    as_destroy(new_as);
+    return err;
+}
+
+/**
+ * sys_execv
+ */
+int sys_execv(const char* argc, char** argv, int *retv)
+{
+    int err=0;
+    int argn;
+    char *progname;
+    size_t got;
 
-    for (int i = 0; i < argn; i++) {
-        ((char**)kargvp)[i] += stackptr;
+    //PATH_MAX is too big for the kernel stack on top of load_elf & VFS
+    progname = kmalloc(PATH_MAX);
+    if(progname == NULL)
+        return ENOMEM;
+
+    err = copyinstr((userptr_t)argc, progname, PATH_MAX,&got);
+    if(err == 0 && got == 1)
+        err = EINVAL;//handles empty progname error
+    if(err != 0){
+        kfree(progname);
+        return err;
     }
 
-    err = copyout(kargvp, (userptr_t)stackptr, padLen);
-    if(err)
+    struct addrspace* old_as;
+    vaddr_t entrypoint, stackptr;
+
+    err = execv_load(progname, argv, &argn, &old_as, &entrypoint, &stackptr);
+    if(err){
+        kfree(progname);
         return err;
+    }
+    thread_as_forget(old_as);
+    as_destroy(old_as);
 
     curthread->t_name = kstrdup(progname); //reset name
-
-    vfs_close(v);/* Definitely Done with the file now.*/
+    kfree(progname);
 
     *retv = 0;
 
@@ -311,6 +604,123 @@ int sys_execv(const char* argc, char** argv, int *retv)
     return 0;
 }
 
+/*
+ * What sys_spawn hands its child: the image it already loaded and the
+ * filetable the child starts with, reference already taken. The path
+ * and fd map are only sys_spawn's scratch space; they live here rather
+ * than on the kernel stack, which load_elf and the VFS need.
+ */
+struct spawnargs {
+	struct addrspace *sa_as;
+	vaddr_t sa_entry;
+	vaddr_t sa_stackptr;
+	int sa_argc;
+	struct filetable *sa_ft;
+	char sa_progname[PATH_MAX];
+	int sa_fdmap[OPEN_MAX];
+};
+
+/**
+ * sys_spawn
+ * Creates a child running path with argv, without fork's address space
+ * copy or trapframe: the image is built by the same loader execv uses,
+ * while we still run on our own address space afterwards.
+ * fdmap, if not NULL, holds nfds parent fds; the child's fd i is
+ * fdmap[i], or closed if that is -1, and fds at or past nfds are closed.
+ * With fdmap NULL the child inherits every open fd, as with fork.
+ * ON SUCCESS: returns the child's pid.
+ * ON ERROR: no child is created and errno is set accordingly.
+ */
+int sys_spawn(const char* path, char** argv, const int* fdmap, int nfds, int *retv)
+{
+	int err;
+	int argn;
+	size_t got;
+	struct spawnargs *sa;
+	struct addrspace *old_as;
+	int *kfdmap;
+	char *progname;
+	pid_t childpid;
+
+	if(fdmap != NULL && (nfds < 0 || nfds > OPEN_MAX))
+		return EINVAL;
+
+	sa = kmalloc(sizeof(struct spawnargs));
+	if(sa == NULL)
+		return ENOMEM;
+	kfdmap = sa->sa_fdmap;
+	progname = sa->sa_progname;
+
+	if(fdmap != NULL){
+		err = copyin((const_userptr_t)fdmap, kfdmap, nfds*sizeof(int));
+		if(err)
+			goto fail;
+		for(int fd = 0; fd<nfds; fd++){
+			if(kfdmap[fd] == -1)
+				continue;
+			if(filetable_get(kfdmap[fd]) == NULL){
+				err = EBADF;
+				goto fail;
+			}
+		}
+	}
+
+	err = copyinstr((const_userptr_t)path, progname, PATH_MAX, &got);
+	if(err == 0 && got == 1)
+		err = EINVAL;//empty progname
+	if(err)
+		goto fail;
+
+	err = execv_load(progname, argv, &argn, &old_as, &sa->sa_entry, &sa->sa_stackptr);
+	if(err)
+		goto fail;
+
+	//the image is the child's; go back to ours
+	sa->sa_as = curthread->t_addrspace;
+	sa->sa_argc = argn;
+	curthread->t_addrspace = old_as;
+	thread_as_activate(old_as);
+
+	if(fdmap == NULL){
+		sa->sa_ft = filetable_share();//shared like fork's
+	}else{
+		sa->sa_ft = filetable_create();
+		if(sa->sa_ft == NULL)
+			err = ENOMEM;
+		else
+			proc_snapshot_files(sa->sa_ft, kfdmap, nfds);
+	}
+
+	if(err == 0){
+		err = thread_fork_child(progname, enter_spawned_process, sa, 0, &childpid);
+		if(err)
+			filetable_release(sa->sa_ft);
+	}
+	if(err){
+		thread_as_forget(sa->sa_as);
+		as_destroy(sa->sa_as);
+		goto fail;
+	}
+
+	//the child may already have exited; its pid was taken before it ran
+	*retv = (int) childpid;
+	return 0;
+
+ fail:
+	kfree(sa);
+	return err;
+}
+
+/*
+ * What sys_fork hands its child: a copy of our trapframe, the
+ * copy-on-write address space and our filetable, reference taken.
+ */
+struct forkargs {
+	struct trapframe fa_tf;
+	struct addrspace *fa_as;
+	struct filetable *fa_ft;
+};
+
 /**
  * sys_fork
  * ON SUCCESS: fork returns twice,
@@ -319,45 +729,42 @@ int sys_execv(const char* argc, char** argv, int *retv)
  * 		once in the child process.
  * 			- In the child process, 0 is returned.
  * ON ERROR: no new process is created, fork only returns once, returning -1, and errno is set according to the error encountered.
+ *
+ * Runs with interrupts on throughout. Nothing else can change our
+ * trapframe, address space or filetable while we are in here (the
+ * process is one thread), so the snapshot only locks what is shared:
+ * each region's cowshare inside as_copy and the filetable's refcount.
+ * Everything the child needs is set up before thread_fork can run it.
  */
 int sys_fork(struct trapframe* ptf, int *retv)
 {
-	int spl = splhigh();//disable interrupts to prevent stale address space copying
-
 	int err = 0;
-	struct thread *child;// To be used to copy FT and AS
-	struct trapframe* ctf = (struct trapframe*)kmalloc(sizeof(struct trapframe));
-	if (ctf ==NULL){
-		splx(spl);
+	pid_t childpid;
+	struct forkargs *fa = kmalloc(sizeof(struct forkargs));
+	if (fa == NULL)
 		return ENOMEM;
-	}
 
-	*ctf = *ptf;
+	fa->fa_tf = *ptf;
 
-	struct addrspace* cas;
-	err = as_copy(curthread->t_addrspace, &cas);
+	err = as_copy(curthread->t_addrspace, &fa->fa_as);//copy-on-write; cheap
 	if(err){
-		splx(spl);
+		kfree(fa);
 		return err;
 	}
 
-	err = thread_fork(curthread->t_name, enter_forked_process, ctf, (unsigned long) cas, &child);
+	//share parents filetable with the child; copied when either changes it
+	fa->fa_ft = filetable_share();
+
+	err = thread_fork_child(curthread->t_name, enter_forked_process, fa, 0, &childpid);
 	if (err){
-		splx(spl);
+		filetable_release(fa->fa_ft);
+		as_destroy(fa->fa_as);
+		kfree(fa);
 		return err;
 	}
 
-	//"copy" parents filetable to the childs & add references where !NULL
-	for(int fd = 0; fd<OPEN_MAX; fd++){
-		child->filetable[fd] = curthread->filetable[fd];
-		if(child->filetable[fd] != NULL)
-			child->filetable[fd]->refcount++;
-	}
-
-	ptable[child->pid]->parent_pid = curthread->pid;//Sets the ppid for the child
-	*retv = (int) child->pid;
-	splx(spl);//Re-Enable interrupts after thread_fork
-
+	//the child may already have exited; its pid was taken before it ran
+	*retv = (int) childpid;
 	return 0;
 }
 
@@ -369,22 +776,51 @@ int sys_fork(struct trapframe* ptf, int *retv)
 void
 enter_forked_process(void* data1, unsigned long ul)//, unsigned long ul)
 {
-	struct trapframe *tf = (struct trapframe*) data1;
-	struct addrspace *as = (struct addrspace*)ul;
+	struct forkargs *fa = (struct forkargs*) data1;
+	(void)ul;
 
 	struct trapframe stack_tf;
-	stack_tf = *tf;
+	stack_tf = fa->fa_tf;
 	stack_tf.tf_a3 = 0;
 	stack_tf.tf_v0 = 0;
 	stack_tf.tf_epc += 4;
 
-	as_copy(as, &curthread->t_addrspace);
-	as_activate(curthread->t_addrspace);//activate the AS
+	proc_get(curthread->pid)->p_ft = fa->fa_ft;
+
+	//sys_fork already made our copy of the parent's AS; just install it
+	curthread->t_addrspace = fa->fa_as;
+	thread_as_activate(fa->fa_as);//activate the AS
+	kfree(fa);
 
 	//warp to user mode with our stack tf
 	mips_usermode(&stack_tf); //Enter user mode for newly forked process
 }
 
+/**
+ * enter_spawned_process
+ * ENTRYPOINT for a thread created by sys_spawn: install the files and
+ * the address space the parent already set up, then enter user mode.
+ */
+void
+enter_spawned_process(void* data1, unsigned long ul)
+{
+	struct spawnargs *sa = (struct spawnargs*) data1;
+	(void)ul;
+
+	proc_get(curthread->pid)->p_ft = sa->sa_ft;
+
+	curthread->t_addrspace = sa->sa_as;
+	thread_as_activate(sa->sa_as);
+
+	int argc = sa->sa_argc;
+	vaddr_t stackptr = sa->sa_stackptr;
+	vaddr_t entrypoint = sa->sa_entry;
+	kfree(sa);
+
+	enter_new_process(argc, (userptr_t)stackptr, stackptr, entrypoint);
+	panic("enter_new_process returned\n");
+}
+
 //////////////////////////////////
 //HELPER FUNCTIONS
 
@@ -393,8 +829,10 @@ enter_forked_process(void* data1, unsigned long ul)//, unsigned long ul)
  * Initializes a process to be placed into our process table
  * allocates memory, sets up fields, calls add_process.
  * This should be called from fork().
+ * Only with CHILD does the new process join the current one's family;
+ * kernel threads don't, so they reap themselves when they exit.
  */
- pid_t process_init(struct thread* t){
+ pid_t process_init(struct thread* t, bool child){
      struct process *proc = kmalloc(sizeof(struct process));
 
      if(proc == NULL)
@@ -402,21 +840,53 @@ enter_forked_process(void* data1, unsigned long ul)//, unsigned long ul)
 
      pid_t mypid;
 
-     if(ptable[2] == NULL){
+     if(proc_family_lk == NULL){//first process; still single-threaded
+         proc_family_lk = lock_create("proc_family");
+         execargs_lk = lock_create("execargs");
+         if(proc_family_lk == NULL || execargs_lk == NULL){
+             kfree(proc);
+             return -1;
+         }
+     }
+
+     if(proc_get(PID_MIN) == NULL){
          proc->parent_pid = -5;//curthread->pid;//INIITS the default pid to negative for testing
+     }else if(!child){
+         proc->parent_pid = -1;//detached, like an orphan
      }else{
          proc->parent_pid = curthread->pid;
      }
      proc->exited = 0;
      proc->exitcode = -1;// means it has not been set and thus not exited
      proc->self = t;
+     proc->p_parent = NULL;
+     proc->p_children.pl_head = proc->p_children.pl_tail = NULL;
+     proc->p_zombies.pl_head = proc->p_zombies.pl_tail = NULL;
+     spinlock_init(&proc->p_zlock);
+     proc->p_nextsib = NULL;
+     proc->p_prevsib = NULL;
+     proc->p_ft = NULL;//kernel threads never get one
+     kusage_init(&proc->p_ru);
+     kusage_init(&proc->p_cru);
      proc->waitcv = cv_create("process_cv");
-     proc->lk_proc = lock_create("process_lk");
+     if(proc->waitcv == NULL){
+         goto fail;
+     }
      mypid = add_process(proc);
      if(mypid < 0)
-         return -1; //error handled by caller
+         goto fail; //error handled by caller
+     proc->p_pid = mypid;
+
+     if(child && proc_get(proc->parent_pid) != NULL)
+         proc_addchild(proc_get(proc->parent_pid), proc);
 
      return mypid;
+
+ fail:
+     if(proc->waitcv != NULL)
+         cv_destroy(proc->waitcv);
+     kfree(proc);
+     return -1;
  }
 
 /**
@@ -424,12 +894,378 @@ enter_forked_process(void* data1, unsigned long ul)//, unsigned long ul)
  * Adds process to the global process array.  This is called from process_init, which is called from fork().
  */
 pid_t add_process(struct process* proc){
+    pid_t pid;
+
+    pid = pid_alloc();
+    if(pid < 0)
+        return -1; //error, full pt.
+
+    KASSERT(proc_get(pid) == NULL);
+    proc_set(pid, proc);
+    return pid;
+}
+
+/**
+ * proc_get
+ * Looks up PID in the process table. Returns NULL for PIDs that
+ * aren't in use, including ones outside the table. O(1).
+ */
+struct process *proc_get(pid_t pid){
+    if(pid < PID_MIN || pid >= pid_limit)
+        return NULL;
+    return ptable[pid / PTABLE_CHUNK][pid % PTABLE_CHUNK];
+}
+
+/**
+ * proc_set
+ * Stores PROC (or NULL) in PID's slot. PID must have come from
+ * pid_alloc.
+ */
+void proc_set(pid_t pid, struct process *proc){
+    KASSERT(pid >= PID_MIN && pid < pid_limit);
+    ptable[pid / PTABLE_CHUNK][pid % PTABLE_CHUNK] = proc;
+}
+
+/*
+ * Where growing the PID space from BASE ends: the next PTABLE_CHUNK
+ * PIDs, or fewer at PID_MAX.
+ */
+static pid_t pid_growtop(pid_t base){
+    pid_t top = (base / PTABLE_CHUNK + 1) * PTABLE_CHUNK;
 
-    for(int i = 2; i<MAX_RUNNING_PROCS + 2; i++){
-        if(ptable[i] == NULL){
-            ptable[i] = proc;
-            return i;
+    return top > PID_MAX + 1 ? PID_MAX + 1 : top;
+}
+
+/*
+ * How big the ring must be to grow the PID space from BASE, or 0 if
+ * it's big enough already. Called with pid_lock held.
+ */
+static unsigned pid_ringneed(pid_t base){
+    //the ring has to be able to hold every PID at once
+    unsigned size = pid_growtop(base) - PID_MIN;
+
+    if(size <= pid_ringsize)
+        return 0;
+    return size < pid_ringsize * 2 ? pid_ringsize * 2 : size;
+}
+
+/*
+ * Add the PIDs from BASE up to pid_growtop(BASE) to the PID space,
+ * using CHUNK (zeroed) for their table slots and, if not NULL, RING
+ * of RINGSIZE entries as the new free ring. Called with pid_lock held,
+ * the ring empty and BASE == pid_limit; allocates nothing, since
+ * kmalloc may sleep. Returns the old ring, for the caller to free
+ * once the lock is dropped.
+ */
+static pid_t *pid_grow(pid_t base, struct process **chunk, pid_t *ring, unsigned ringsize){
+    pid_t *oldring = NULL;
+    pid_t top = pid_growtop(base);
+
+    KASSERT(spinlock_do_i_hold(&pid_lock));
+    KASSERT(pid_nfree == 0 && base == pid_limit);
+
+    if(ring != NULL){
+        oldring = pid_ring;//empty, nothing to copy
+        pid_ring = ring;
+        pid_ringsize = ringsize;
+        pid_head = 0;
+    }
+    KASSERT(pid_ringsize >= (unsigned)(top - PID_MIN));
+
+    for(pid_t pid = base; pid < top; pid++){
+        pid_ring[(pid_head + pid_nfree) % pid_ringsize] = pid;
+        pid_nfree++;
+    }
+
+    //proc_get reads these without the lock: the zeroed chunk has to be
+    //visible before the pointer to it, and that before the new limit
+    PROC_MEMBAR();
+    ptable[base / PTABLE_CHUNK] = chunk;
+    PROC_MEMBAR();
+    pid_limit = top;
+    return oldring;
+}
+
+/**
+ * pid_alloc
+ * Takes the free PID that has been free the longest, growing the PID
+ * space if there isn't one. O(1) (amortized, counting the growth).
+ * Growing allocates with pid_lock dropped and then looks again, since
+ * someone may have freed a PID or grown the space in the meantime.
+ * Returns -1 if out of PIDs or memory.
+ */
+pid_t pid_alloc(void){
+    struct process **chunk = NULL;
+    pid_t *ring = NULL, *oldring = NULL;
+    unsigned ringsize = 0, need;
+    pid_t pid = -1;
+    pid_t base;
+
+    spinlock_acquire(&pid_lock);
+    while(pid_nfree == 0){
+        base = pid_limit;
+        if(base > PID_MAX)
+            break;//out of PIDs
+        need = pid_ringneed(base);
+        if(chunk != NULL && (need == 0 || ringsize >= need)){
+            oldring = pid_grow(base, chunk, need ? ring : NULL, ringsize);
+            chunk = NULL;
+            if(need)
+                ring = NULL;
+            break;
+        }
+
+        spinlock_release(&pid_lock);
+        if(chunk == NULL){
+            chunk = kmalloc(PTABLE_CHUNK * sizeof(struct process *));
+            if(chunk != NULL){
+                for(int i = 0; i < PTABLE_CHUNK; i++)
+                    chunk[i] = NULL;
+            }
+        }
+        if(need > ringsize){
+            if(ring != NULL)
+                kfree(ring);
+            ring = kmalloc(need * sizeof(pid_t));
+            ringsize = (ring == NULL) ? 0 : need;
         }
+        spinlock_acquire(&pid_lock);
+
+        if(chunk == NULL || need > ringsize)
+            break;//out of memory; unless a PID turned up meanwhile
+    }
+    if(pid_nfree > 0){
+        pid = pid_ring[pid_head];
+        pid_head = (pid_head + 1) % pid_ringsize;
+        pid_nfree--;
+    }
+    spinlock_release(&pid_lock);
+
+    //whatever we allocated and didn't use, and the ring we replaced
+    if(chunk != NULL)
+        kfree(chunk);
+    if(ring != NULL)
+        kfree(ring);
+    if(oldring != NULL)
+        kfree(oldring);
+    return pid;
+}
+
+/**
+ * pid_free
+ * Puts PID at the back of the free ring. Call once the ptable slot
+ * has been cleared. O(1).
+ */
+void pid_free(pid_t pid){
+    KASSERT(pid >= PID_MIN && pid < pid_limit);
+
+    spinlock_acquire(&pid_lock);
+    KASSERT(pid_nfree < pid_ringsize);
+    pid_ring[(pid_head + pid_nfree) % pid_ringsize] = pid;
+    pid_nfree++;
+    spinlock_release(&pid_lock);
+}
+
+/*
+ * Process list helpers. Called with proc_family_lk held.
+ */
+static void proclist_addtail(struct proclist *pl, struct process *proc){
+    proc->p_nextsib = NULL;
+    proc->p_prevsib = pl->pl_tail;
+    if(pl->pl_tail != NULL)
+        pl->pl_tail->p_nextsib = proc;
+    else
+        pl->pl_head = proc;
+    pl->pl_tail = proc;
+}
+
+static void proclist_remove(struct proclist *pl, struct process *proc){
+    if(proc->p_prevsib != NULL)
+        proc->p_prevsib->p_nextsib = proc->p_nextsib;
+    else
+        pl->pl_head = proc->p_nextsib;
+    if(proc->p_nextsib != NULL)
+        proc->p_nextsib->p_prevsib = proc->p_prevsib;
+    else
+        pl->pl_tail = proc->p_prevsib;
+    proc->p_nextsib = proc->p_prevsib = NULL;
+}
+
+/**
+ * proc_addchild
+ * Links CHILD onto PARENT's child list. O(1).
+ */
+void proc_addchild(struct process *parent, struct process *child){
+    lock_acquire(proc_family_lk);
+    KASSERT(child->p_parent == NULL);
+    child->p_parent = parent;
+    proclist_addtail(&parent->p_children, child);
+    lock_release(proc_family_lk);
+}
+
+/**
+ * proc_snapshot_files
+ * Fills the new, empty filetable FT for a spawned child: its fd i is
+ * our fd FDMAP[i] for i < NFDS (closed if -1) and everything else is
+ * closed. Takes a reference on each openfile. The fds in FDMAP must
+ * already have been checked.
+ */
+static void proc_snapshot_files(struct filetable *ft, const int *fdmap, int nfds){
+    for(int fd = 0; fd<nfds; fd++){
+        if(fdmap[fd] == -1)
+            continue;
+        ft->ftarr[fd] = filetable_get(fdmap[fd]);
+        openfile_incref(ft->ftarr[fd]);
+    }
+}
+
+/*
+ * Called from exit with proc_family_lk held: detaches every child of
+ * PARENT, running or exited, and resets its PPID. Costs time in the
+ * number of children, not the table size. Exited children that were
+ * never waited for are freed now, since nobody can wait for them any
+ * more; running ones free themselves when they exit.
+ */
+static void proc_orphan_children(struct process *parent){
+    struct process *child;
+
+    while((child = parent->p_children.pl_head) != NULL){
+        proclist_remove(&parent->p_children, child);
+        child->parent_pid = -1;//Sets PPID to invalid number
+        child->p_parent = NULL;
+    }
+    while(1){
+        spinlock_acquire(&parent->p_zlock);
+        child = parent->p_zombies.pl_head;
+        if(child != NULL)
+            proclist_remove(&parent->p_zombies, child);
+        spinlock_release(&parent->p_zlock);
+        if(child == NULL)
+            break;
+        child->parent_pid = -1;
+        child->p_parent = NULL;
+        proc_reap(child);
+    }
+}
+
+/**
+ * proc_collect
+ * Takes exited CHILD out of ME's family for waitpid. Called either
+ * with proc_family_lk held or from the fast path in proc_waitchild.
+ */
+static void proc_collect(struct process *me, struct process *child){
+    KASSERT(child->exited);
+
+    spinlock_acquire(&me->p_zlock);
+    proclist_remove(&me->p_zombies, child);
+    spinlock_release(&me->p_zlock);
+    child->p_parent = NULL;
+    //its usage, and that of everything it waited for, is now ours
+    kusage_add(&me->p_cru, &child->p_ru);
+    kusage_add(&me->p_cru, &child->p_cru);
+}
+
+/**
+ * kusage_init
+ * Zeroes KU. The per-call block isn't allocated until it's needed.
+ */
+void kusage_init(struct kusage *ku){
+    bzero(ku, sizeof(*ku));
+}
+
+/**
+ * kusage_cleanup
+ * Frees KU's per-call block, if it has one.
+ */
+void kusage_cleanup(struct kusage *ku){
+    if(ku->ru_nsyscalls != NULL){
+        kfree(ku->ru_nsyscalls);
+        ku->ru_nsyscalls = NULL;
     }
-    return -1; //error, full pt.
+}
+
+/**
+ * kusage_nsyscalls
+ * Returns KU's per-call block, allocating it (zeroed) if need be, or
+ * NULL if out of memory, in which case the counts just get lost.
+ */
+static uint32_t *kusage_nsyscalls(struct kusage *ku){
+    if(ku->ru_nsyscalls == NULL){
+        ku->ru_nsyscalls = kmalloc(RU_NSYSCALLS * sizeof(uint32_t));
+        if(ku->ru_nsyscalls != NULL)
+            bzero(ku->ru_nsyscalls, RU_NSYSCALLS * sizeof(uint32_t));
+    }
+    return ku->ru_nsyscalls;
+}
+
+/**
+ * kusage_syscall
+ * Counts a call to CALLNO. Numbers past RU_NSYSCALLS aren't counted.
+ */
+void kusage_syscall(struct kusage *ku, int callno){
+    uint32_t *counts;
+
+    if(callno < 0 || callno >= RU_NSYSCALLS)
+        return;
+    counts = kusage_nsyscalls(ku);
+    if(counts != NULL)
+        counts[callno]++;
+}
+
+/**
+ * kusage_add
+ * Adds the counts in SRC to DST.
+ */
+void kusage_add(struct kusage *dst, const struct kusage *src){
+    uint32_t *counts;
+
+    dst->ru_ticks += src->ru_ticks;
+    dst->ru_nvcsw += src->ru_nvcsw;
+    dst->ru_nivcsw += src->ru_nivcsw;
+    dst->ru_faults += src->ru_faults;
+    dst->ru_inbytes += src->ru_inbytes;
+    dst->ru_outbytes += src->ru_outbytes;
+    if(src->ru_nsyscalls == NULL)
+        return;
+    counts = kusage_nsyscalls(dst);
+    if(counts == NULL)
+        return;
+    for(int i = 0; i<RU_NSYSCALLS; i++)
+        counts[i] += src->ru_nsyscalls[i];
+}
+
+/**
+ * kusage_move
+ * Hands SRC's counts, per-call block included, over to empty DST.
+ */
+void kusage_move(struct kusage *dst, struct kusage *src){
+    KASSERT(dst->ru_nsyscalls == NULL);
+    *dst = *src;
+    src->ru_nsyscalls = NULL;
+}
+
+/**
+ * kusage_copyout
+ * Copies KU out to user USAGE as a struct rusage, field by field,
+ * so nothing rusage-sized ever sits on the kernel stack.
+ */
+int kusage_copyout(const struct kusage *ku, struct rusage *usage){
+    static const uint32_t nocalls[RU_NSYSCALLS];
+    int err;
+
+    err = copyout(&ku->ru_ticks, (userptr_t)&usage->ru_ticks, sizeof(ku->ru_ticks));
+    if(!err)
+        err = copyout(&ku->ru_nvcsw, (userptr_t)&usage->ru_nvcsw, sizeof(ku->ru_nvcsw));
+    if(!err)
+        err = copyout(&ku->ru_nivcsw, (userptr_t)&usage->ru_nivcsw, sizeof(ku->ru_nivcsw));
+    if(!err)
+        err = copyout(&ku->ru_faults, (userptr_t)&usage->ru_faults, sizeof(ku->ru_faults));
+    if(!err)
+        err = copyout(&ku->ru_inbytes, (userptr_t)&usage->ru_inbytes, sizeof(ku->ru_inbytes));
+    if(!err)
+        err = copyout(&ku->ru_outbytes, (userptr_t)&usage->ru_outbytes, sizeof(ku->ru_outbytes));
+    if(!err)
+        err = copyout(ku->ru_nsyscalls != NULL ? ku->ru_nsyscalls : nocalls,
+                      (userptr_t)usage->ru_nsyscalls, sizeof(usage->ru_nsyscalls));
+    return err;
 }
@@ -0,0 +1,177 @@
+/*
+ * wqtest.c
+ * SPB & FAR
+ * Menu test for the per-cpu workqueues (see workqueue.h).
+ *   1) wqtest
+ * Helpers
+ *   1) wq_count
+ *   2) wq_slow
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <thread.h>
+#include <current.h>
+#include <test.h>
+#include <workqueue.h>
+
+#define NITEMS   8
+#define SLOWSPIN 32
+
+static struct work items[NITEMS];
+static volatile unsigned counts[NITEMS];
+static volatile bool slowdone;
+
+/**
+ * wq_count
+ * Work function: bumps counts[DATA2].
+ */
+static
+void
+wq_count(void *data1, unsigned long data2)
+{
+	(void)data1;
+	counts[data2]++;
+}
+
+/**
+ * wq_slow
+ * Work function: keeps the worker busy for a while, so work_flush has
+ * something running to wait for, then says it's done.
+ */
+static
+void
+wq_slow(void *data1, unsigned long data2)
+{
+	int i;
+
+	(void)data1;
+	(void)data2;
+	for (i=0; i<SLOWSPIN; i++) {
+		thread_yield();
+	}
+	slowdone = true;
+}
+
+/**
+ * wqtest
+ * Runs queued, delayed, cancelled and flushed work, and work queued
+ * the way an interrupt handler would queue it. Panics on failure.
+ */
+int
+wqtest(int nargs, char **args)
+{
+	unsigned expect[NITEMS];
+	int i, spl;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	for (i=0; i<NITEMS; i++) {
+		work_init(&items[i], wq_count, NULL, i);
+		counts[i] = 0;
+		expect[i] = 0;
+	}
+
+	/*
+	 * Plain queueing. A second queue of the same item only takes
+	 * if the first run has already started; then it runs twice.
+	 */
+	for (i=0; i<NITEMS; i++) {
+		if (!work_queue(&items[i])) {
+			panic("wqtest: unqueued item %d wouldn't queue\n", i);
+		}
+		expect[i]++;
+	}
+	if (work_queue(&items[0])) {
+		expect[0]++;
+	}
+	for (i=0; i<NITEMS; i++) {
+		work_flush(&items[i]);
+		if (counts[i] != expect[i]) {
+			panic("wqtest: item %d ran %u times, not %u\n",
+			      i, counts[i], expect[i]);
+		}
+	}
+	kprintf("wqtest: queue ok\n");
+
+	/* Delayed; comes due from the hardclock path. */
+	work_queue_delayed(&items[1], 3);
+	expect[1]++;
+	work_flush(&items[1]);
+	if (counts[1] != expect[1]) {
+		panic("wqtest: delayed item didn't run\n");
+	}
+	kprintf("wqtest: delayed ok\n");
+
+	/* Cancel something that won't come due for a long while. */
+	work_queue_delayed(&items[2], 100000);
+	if (!work_cancel(&items[2])) {
+		panic("wqtest: couldn't cancel a delayed item\n");
+	}
+	if (work_cancel(&items[2])) {
+		panic("wqtest: cancelled the same item twice\n");
+	}
+	work_flush(&items[2]);
+	if (counts[2] != expect[2]) {
+		panic("wqtest: cancelled item ran anyway\n");
+	}
+	/* Once cancelled it can be queued again. */
+	if (!work_queue(&items[2])) {
+		panic("wqtest: cancelled item wouldn't queue again\n");
+	}
+	expect[2]++;
+	work_flush(&items[2]);
+	if (counts[2] != expect[2]) {
+		panic("wqtest: requeued item didn't run\n");
+	}
+
+	/* Cancel racing the worker: either it ran or it didn't. */
+	work_queue(&items[3]);
+	if (!work_cancel(&items[3])) {
+		expect[3]++;
+	}
+	work_flush(&items[3]);
+	if (counts[3] != expect[3]) {
+		panic("wqtest: cancel disagrees with item, which ran "
+		      "%u times\n", counts[3]);
+	}
+	kprintf("wqtest: cancel ok\n");
+
+	/* Flush has to wait for a run that is under way. */
+	slowdone = false;
+	work_init(&items[4], wq_slow, NULL, 0);
+	work_queue(&items[4]);
+	work_flush(&items[4]);
+	if (!slowdone) {
+		panic("wqtest: flush returned while item was running\n");
+	}
+	kprintf("wqtest: flush ok\n");
+
+	/*
+	 * Queue the way a device interrupt handler would: interrupts
+	 * off, and marked as in an interrupt, so that anything on the
+	 * way that tried to sleep would assert.
+	 */
+	spl = splhigh();
+	curthread->t_in_interrupt = true;
+	ok = work_queue(&items[5]);
+	curthread->t_in_interrupt = false;
+	splx(spl);
+	if (!ok) {
+		panic("wqtest: couldn't queue from interrupt context\n");
+	}
+	expect[5]++;
+	work_flush(&items[5]);
+	if (counts[5] != expect[5]) {
+		panic("wqtest: item queued from interrupt didn't run\n");
+	}
+	kprintf("wqtest: interrupt ok\n");
+
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * runqueue.c
+ * SPB & FAR
+ * Priority-bitmap run queue (see runqueue.h)
+ *   1) runqueue_init / runqueue_cleanup
+ *   2) runqueue_add
+ *   3) runqueue_remhead / runqueue_remtail
+ *   4) runqueue_remove
+ *
+ * None of these lock anything; the caller holds the owning cpu's
+ * runqueue lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <threadlist.h>
+#include <runqueue.h>
+
+/*
+ * The r3000 has no count-leading/trailing-zeros instruction, so find
+ * bit numbers with a de Bruijn multiply and a table lookup instead of
+ * looping over the levels.
+ */
+static const uint8_t runqueue_debruijn[32] = {
+	0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+	31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+};
+
+/* Number of a single set bit. */
+static
+unsigned
+runqueue_bitnum(uint32_t bit)
+{
+	return runqueue_debruijn[(uint32_t)(bit * 0x077CB531U) >> 27];
+}
+
+/* Lowest set bit of a nonzero X: the highest priority level. */
+static
+unsigned
+runqueue_first(uint32_t x)
+{
+	return runqueue_bitnum(x & (~x + 1));
+}
+
+/* Highest set bit of a nonzero X: the lowest priority level. */
+static
+unsigned
+runqueue_last(uint32_t x)
+{
+	x |= x >> 1;
+	x |= x >> 2;
+	x |= x >> 4;
+	x |= x >> 8;
+	x |= x >> 16;
+	return runqueue_bitnum(x ^ (x >> 1));
+}
+
+void
+runqueue_init(struct runqueue *rq)
+{
+	unsigned i;
+
+	rq->rq_bitmap = 0;
+	rq->rq_count = 0;
+	for (i=0; i<RUNQ_LEVELS; i++) {
+		threadlist_init(&rq->rq_lists[i]);
+	}
+}
+
+void
+runqueue_cleanup(struct runqueue *rq)
+{
+	unsigned i;
+
+	KASSERT(rq->rq_bitmap == 0);
+	KASSERT(rq->rq_count == 0);
+	for (i=0; i<RUNQ_LEVELS; i++) {
+		threadlist_cleanup(&rq->rq_lists[i]);
+	}
+}
+
+bool
+runqueue_isempty(struct runqueue *rq)
+{
+	return rq->rq_bitmap == 0;
+}
+
+void
+runqueue_add(struct runqueue *rq, struct thread *t)
+{
+	unsigned pri = t->t_priority;
+
+	KASSERT(pri < RUNQ_LEVELS);
+	threadlist_addtail(&rq->rq_lists[pri], t);
+	rq->rq_bitmap |= (uint32_t)1 << pri;
+	rq->rq_count++;
+}
+
+struct thread *
+runqueue_remhead(struct runqueue *rq)
+{
+	struct thread *t;
+	unsigned pri;
+
+	if (rq->rq_bitmap == 0) {
+		return NULL;
+	}
+	pri = runqueue_first(rq->rq_bitmap);
+	t = threadlist_remhead(&rq->rq_lists[pri]);
+	KASSERT(t != NULL);
+	if (threadlist_isempty(&rq->rq_lists[pri])) {
+		rq->rq_bitmap &= ~((uint32_t)1 << pri);
+	}
+	rq->rq_count--;
+	return t;
+}
+
+struct thread *
+runqueue_remtail(struct runqueue *rq)
+{
+	struct thread *t;
+	unsigned pri;
+
+	if (rq->rq_bitmap == 0) {
+		return NULL;
+	}
+	pri = runqueue_last(rq->rq_bitmap);
+	t = threadlist_remtail(&rq->rq_lists[pri]);
+	KASSERT(t != NULL);
+	if (threadlist_isempty(&rq->rq_lists[pri])) {
+		rq->rq_bitmap &= ~((uint32_t)1 << pri);
+	}
+	rq->rq_count--;
+	return t;
+}
+
+void
+runqueue_remove(struct runqueue *rq, struct thread *t)
+{
+	unsigned pri = t->t_priority;
+
+	KASSERT(pri < RUNQ_LEVELS);
+	threadlist_remove(&rq->rq_lists[pri], t);
+	if (threadlist_isempty(&rq->rq_lists[pri])) {
+		rq->rq_bitmap &= ~((uint32_t)1 << pri);
+	}
+	rq->rq_count--;
+}
@@ -0,0 +1,221 @@
+/*
+ * swtrace.c
+ * SPB & FAR
+ * Per-cpu context switch trace buffer
+ *   1) swtrace_create
+ *   2) swtrace_record
+ *   3) swtracecmd (menu command)
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <swtrace.h>
+
+volatile bool swtrace_enabled = false;
+
+/* List of every cpu's trace buffer. Only grows, and only at boot. */
+static struct swtrace *swtrace_all;
+
+static const char *const swtrace_events[] = { "switch", "ready", "sleep" };
+static const char *const swtrace_states[] = { "run", "ready", "sleep", "zombie" };
+
+/**
+ * swtrace_create
+ * Allocates the trace buffer for cpu CPUNUM. Called from cpu_create.
+ * Returns NULL if out of memory, in which case that cpu isn't traced.
+ */
+struct swtrace *
+swtrace_create(unsigned cpunum)
+{
+	struct swtrace *st;
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return NULL;
+	}
+	bzero(st, sizeof(*st));
+	st->st_cpunum = cpunum;
+	st->st_link = swtrace_all;
+	swtrace_all = st;
+	return st;
+}
+
+/**
+ * swtrace_record
+ * Appends one record to the current cpu's ring. The caller has
+ * interrupts off, so nothing else can touch this ring until we're
+ * done; st_next is bumped last so a concurrent dump from another cpu
+ * at worst sees the slot being overwritten.
+ */
+void
+swtrace_record(unsigned event, struct thread *from, struct thread *to,
+	       threadstate_t state, const char *wchan)
+{
+	struct swtrace *st = curcpu->c_swtrace;
+	struct swtrace_rec *r;
+	unsigned i;
+
+	if (st == NULL) {
+		return;
+	}
+
+	r = &st->st_recs[st->st_next & (SWTRACE_SIZE - 1)];
+	r->sr_seq = st->st_next;
+	r->sr_time = curcpu->c_hardclocks;
+	r->sr_event = event;
+	r->sr_state = state;
+	r->sr_from = from;
+	r->sr_to = to;
+	r->sr_frompid = (from != NULL) ? from->pid : -1;
+	r->sr_topid = (to != NULL) ? to->pid : -1;
+
+	i = 0;
+	if (wchan != NULL) {
+		for (; i < SWTRACE_NAMELEN - 1 && wchan[i] != 0; i++) {
+			r->sr_wchan[i] = wchan[i];
+		}
+	}
+	r->sr_wchan[i] = 0;
+
+	st->st_next++;
+}
+
+////////////////////////////////////////////////////////////
+// Dumping
+
+/*
+ * Emit one line either to the console (VN == NULL) or to the file
+ * VN at *OFFSET.
+ */
+static
+int
+swtrace_emit(struct vnode *vn, off_t *offset, const char *line)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+	int err;
+
+	if (vn == NULL) {
+		kprintf("%s", line);
+		return 0;
+	}
+
+	len = strlen(line);
+	uio_kinit(&iov, &ku, (void *)line, len, *offset, UIO_WRITE);
+	err = VOP_WRITE(vn, &ku);
+	if (err) {
+		return err;
+	}
+	*offset = ku.uio_offset;
+	return 0;
+}
+
+/*
+ * Write out every cpu's buffer, oldest record first, followed by how
+ * many address space loads the switches made and skipped. Tracing is
+ * switched off for the duration so the rings hold still.
+ */
+static
+int
+swtrace_dump(struct vnode *vn)
+{
+	struct swtrace *st;
+	struct swtrace_rec *r;
+	char line[128];
+	uint32_t first, last, seq;
+	unsigned activations, skipped;
+	off_t offset = 0;
+	bool was_enabled;
+	int err = 0;
+
+	was_enabled = swtrace_enabled;
+	swtrace_enabled = false;
+
+	snprintf(line, sizeof(line),
+		 "cpu seq time event from(pid) to(pid) state wchan\n");
+	err = swtrace_emit(vn, &offset, line);
+
+	for (st = swtrace_all; st != NULL && !err; st = st->st_link) {
+		last = st->st_next;
+		first = (last > SWTRACE_SIZE) ? last - SWTRACE_SIZE : 0;
+		for (seq = first; seq != last && !err; seq++) {
+			r = &st->st_recs[seq & (SWTRACE_SIZE - 1)];
+			snprintf(line, sizeof(line),
+				 "%u %u %u %s %p(%d) %p(%d) %s %s\n",
+				 st->st_cpunum, r->sr_seq, r->sr_time,
+				 swtrace_events[r->sr_event],
+				 r->sr_from, (int)r->sr_frompid,
+				 r->sr_to, (int)r->sr_topid,
+				 swtrace_states[r->sr_state],
+				 r->sr_wchan[0] ? r->sr_wchan : "-");
+			err = swtrace_emit(vn, &offset, line);
+		}
+	}
+
+	if (!err) {
+		thread_as_stats(&activations, &skipped);
+		snprintf(line, sizeof(line),
+			 "as_activate: %u done, %u skipped\n",
+			 activations, skipped);
+		err = swtrace_emit(vn, &offset, line);
+	}
+
+	swtrace_enabled = was_enabled;
+	return err;
+}
+
+/**
+ * swtracecmd
+ * Menu command: swt [on|off|dump|save [file]]
+ */
+int
+swtracecmd(int nargs, char **args)
+{
+	char *path;
+	const char *file;
+	struct vnode *vn;
+	int err;
+
+	if (nargs < 2 || !strcmp(args[1], "dump")) {
+		return swtrace_dump(NULL);
+	}
+	if (!strcmp(args[1], "on")) {
+		swtrace_enabled = true;
+		return 0;
+	}
+	if (!strcmp(args[1], "off")) {
+		swtrace_enabled = false;
+		return 0;
+	}
+	if (!strcmp(args[1], "save")) {
+		/* vfs_open may modify its path argument, so copy it */
+		file = (nargs > 2) ? args[2] : "emu0:swtrace.txt";
+		if (strlen(file) >= PATH_MAX) {
+			return ENAMETOOLONG;
+		}
+		path = kstrdup(file);
+		if (path == NULL) {
+			return ENOMEM;
+		}
+		err = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+		kfree(path);
+		if (err) {
+			return err;
+		}
+		err = swtrace_dump(vn);
+		vfs_close(vn);
+		return err;
+	}
+
+	kprintf("Usage: swt [on|off|dump|save [file]]\n");
+	return EINVAL;
+}
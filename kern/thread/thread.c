@@ -41,6 +41,7 @@
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
+#include <runqueue.h>
 #include <threadprivate.h>
 #include <current.h>
 #include <synch.h>
@@ -48,14 +49,76 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <process.h>
+#include <swtrace.h>
+#include <workqueue.h>
 
 #include "opt-synchprobs.h"
 #include "opt-defaultscheduler.h"
+#include "opt-hashwait.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Zombie reaping. SPB & FAR
+ * The reaper destroys at most REAPER_BATCH zombies before yielding.
+ * It runs at PRI_LOWEST, which a busy cpu may never get down to, so
+ * once more than ZOMBIE_HIWAT zombies are waiting thread_switch raises
+ * it to PRI_HIGHEST until it has them down to ZOMBIE_LOWAT. Meanwhile
+ * thread_switch also destroys up to EXORCISE_BATCH of them inline,
+ * but only ones without an address space; see exorcise().
+ */
+#define REAPER_BATCH	16
+#define ZOMBIE_HIWAT	64
+#define ZOMBIE_LOWAT	(ZOMBIE_HIWAT / 2)
+#define EXORCISE_BATCH	8
+
+#if OPT_HASHWAIT
+
+/*
+ * Hashed wait channels. SPB & FAR
+ *
+ * A wait channel keeps its own lock, but not its own list of sleepers:
+ * its address is the key into a global table of wait queues, and
+ * sleepers are told apart by t_wchan. Since nearly all channels are
+ * idle nearly all the time, this saves each semaphore, lock and CV a
+ * threadlist, at the price of sharing a queue with whatever else
+ * hashes alongside.
+ *
+ * The channel lock keeps the wchan contract exactly as before (held
+ * from wchan_lock through the sleep, nestable the way cv_wait nests
+ * it inside lock_release). wq_lock only guards the shared list: it is
+ * taken innermost, for the list work alone, and nothing else is ever
+ * acquired while it's held, so it can't deadlock against anything.
+ */
+struct wchan {
+	const char *wc_name;		/* name for this channel */
+	struct spinlock wc_lock;	/* lock for mutual exclusion */
+};
+
+struct waitqueue {
+	struct threadlist wq_threads;	/* sleepers on all channels here */
+	struct spinlock wq_lock;	/* protects wq_threads only */
+};
+
+#define WAITQ_SIZE	64	/* must be a power of 2 */
+
+static struct waitqueue waitqueues[WAITQ_SIZE];
+
+static
+struct waitqueue *
+wchan_queue(struct wchan *wc)
+{
+	uintptr_t key = (uintptr_t)wc;
+
+	/* kmalloc'd addresses have their low bits in common */
+	key = (key >> 4) ^ (key >> 10);
+	return &waitqueues[key & (WAITQ_SIZE - 1)];
+}
+
+#else
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -63,6 +126,8 @@ struct wchan {
 	struct spinlock wc_lock;	/* lock for mutual exclusion */
 };
 
+#endif /* OPT_HASHWAIT */
+
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -71,6 +136,13 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+static void thread_make_runnable(struct thread *target, bool already_have_lock);
+static void wchan_addsleeper(struct wchan *wc, struct thread *t);
+static int thread_fork_common(const char *name, bool child,
+			      void (*entrypoint)(void *, unsigned long),
+			      void *data1, unsigned long data2,
+			      struct thread **ret, pid_t *childpid);
+
 /*
  * Stick a magic number on the bottom end of the stack. This will
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
@@ -110,11 +182,13 @@ thread_checkstack(struct thread *thread)
 
 /*
  * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * for each CPU and to create subsequent forked threads. With CHILD,
+ * its process is a child of the current one, for waitpid; otherwise
+ * it has no parent and is freed as soon as it exits.
  */
 static
 struct thread *
-thread_create(const char *name)
+thread_create(const char *name, bool child)
 {
 	struct thread *thread;
 
@@ -131,6 +205,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
+	thread->t_wchan = NULL;
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
@@ -152,19 +227,32 @@ thread_create(const char *name)
 	thread->t_cwd = NULL;
 
 	/* If you add to struct thread, be sure to initialize here TODO*/
-	for(int i = 0; i<OPEN_MAX; i++)
-	{
-		thread->filetable[i] = NULL;
-	}
+	kusage_init(&thread->t_ru);
+	thread->t_pinned = false;
 
-	pid_t temppid = process_init(thread);
+	pid_t temppid = process_init(thread, child);
 
 	if(temppid == -1){
+		/* out of PIDs (or memory); undo the above */
+		threadlistnode_cleanup(&thread->t_listnode);
+		thread_machdep_cleanup(&thread->t_machdep);
+		kfree(thread->t_name);
+		kfree(thread);
 		return NULL;
 	}
 
 	thread->pid = temppid;
 
+	/* Scheduling fields; everyone starts out in the normal class */
+	thread->t_class = SCHED_NORMAL;
+	thread->t_priority = PRI_DEFAULT;
+	thread->t_rt_period = 0;
+	thread->t_rt_budget = 0;
+	thread->t_rt_used = 0;
+	thread->t_rt_deadline = 0;
+	thread->t_rt_throttled = false;
+	thread->t_rt_misses = 0;
+	thread->t_rt_overruns = 0;
 
 	return thread;
 }
@@ -194,11 +282,27 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	c->c_reaper = NULL;
+	c->c_reaper_wc = NULL;
+	c->c_workq = NULL;
 	c->c_hardclocks = 0;
+	c->c_swtrace = NULL;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	runqueue_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_yieldto = NULL;
+	c->c_curas = NULL;
+	c->c_as_activations = 0;
+	c->c_as_skipped = 0;
+	c->c_asidgen = 0;
+	c->c_tlb_faults = 0;
+	c->c_tlb_flushes = 0;
+
+	threadlist_init(&c->c_rtqueue);
+	threadlist_init(&c->c_rtthrottled);
+	c->c_rt_util = 0;
+	c->c_rt_misses = 0;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -209,8 +313,11 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	/* Not fatal; the cpu just doesn't get traced */
+	c->c_swtrace = swtrace_create(c->c_number);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
-	c->c_curthread = thread_create(namebuf);
+	c->c_curthread = thread_create(namebuf, false);
 	if (c->c_curthread == NULL) {
 		panic("cpu_create: thread_create failed\n");
 	}
@@ -261,9 +368,12 @@ thread_destroy(struct thread *thread)
 	/* VFS fields, cleaned up in thread_exit */
 	KASSERT(thread->t_cwd == NULL);
 
-	/* VM fields, cleaned up in thread_exit */
+	/* VM fields, cleaned up in thread_reap */
 	KASSERT(thread->t_addrspace == NULL);
 
+	/* Usage, handed to the process in thread_exit */
+	KASSERT(thread->t_ru.ru_nsyscalls == NULL);
+
 	/* Thread subsystem fields */
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
@@ -278,23 +388,202 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * Finish off one zombie: its address space, which thread_exit leaves
+ * behind, and then the thread itself.
+ */
+static
+void
+thread_reap(struct thread *z)
+{
+	struct addrspace *as;
+
+	KASSERT(z != curthread);
+	KASSERT(z->t_state == S_ZOMBIE);
+
+	if (z->t_addrspace != NULL) {
+		as = z->t_addrspace;
+		z->t_addrspace = NULL;
+		thread_as_forget(as);
+		as_destroy(as);
+	}
+	thread_destroy(z);
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu. Normally the cpu's reaper thread
+ * takes care of them; this is only used from thread_switch before the
+ * reaper exists or when it has fallen too far behind.
+ *
+ * We're at splhigh in the tail of a context switch here, where we
+ * must not sleep, and as_destroy can (releasing page fills takes a
+ * sleep lock and drops vnode references). So only the stack and the
+ * thread itself are freed here; zombies that still have an address
+ * space go to the back of the list for the reaper, which we kick.
+ * At most EXORCISE_BATCH zombies are looked at per call, so a long
+ * list doesn't cost every context switch a walk over all of it.
  */
 static
 void
 exorcise(void)
 {
 	struct thread *z;
+	unsigned n, left;
 
-	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
-		KASSERT(z != curthread);
-		KASSERT(z->t_state == S_ZOMBIE);
+	left = 0;
+	n = curcpu->c_zombies.tl_count;
+	if (n > EXORCISE_BATCH) {
+		n = EXORCISE_BATCH;
+	}
+	while (n-- > 0) {
+		z = threadlist_remhead(&curcpu->c_zombies);
+		KASSERT(z != NULL);
+		if (z->t_addrspace != NULL) {
+			threadlist_addtail(&curcpu->c_zombies, z);
+			left++;
+			continue;
+		}
 		thread_destroy(z);
 	}
+
+	if (left > 0 && curcpu->c_reaper_wc != NULL) {
+		wchan_wakeone(curcpu->c_reaper_wc);
+	}
+}
+
+/*
+ * Per-cpu reaper thread. SPB & FAR
+ *
+ * Runs at PRI_LOWEST, so it only gets the cpu when nothing else wants
+ * it, and by then every thread that exited in the meantime is waiting
+ * for it. If that takes too long, thread_reaper_boost raises it until
+ * it has caught up, and it drops itself back. It is never migrated, so c_zombies is always its own cpu's
+ * list; and since that list is only touched with interrupts off, which
+ * holding the wchan lock implies, checking it and going to sleep can't
+ * race with thread_exit adding to it.
+ */
+static
+void
+thread_reaper(void *data1, unsigned long data2)
+{
+	struct cpu *c = data1;
+	struct threadlist batch;
+	struct thread *z;
+	unsigned n;
+	int spl;
+
+	(void)data2;
+	threadlist_init(&batch);
+
+	while (1) {
+		KASSERT(curcpu->c_self == c);
+
+		wchan_lock(c->c_reaper_wc);
+		while (threadlist_isempty(&c->c_zombies)) {
+			wchan_sleep(c->c_reaper_wc);
+			wchan_lock(c->c_reaper_wc);
+		}
+		wchan_unlock(c->c_reaper_wc);
+
+		spl = splhigh();
+		for (n = 0; n < REAPER_BATCH; n++) {
+			z = threadlist_remhead(&c->c_zombies);
+			if (z == NULL) {
+				break;
+			}
+			threadlist_addtail(&batch, z);
+		}
+		if (c->c_zombies.tl_count <= ZOMBIE_LOWAT) {
+			/* caught up (or never boosted) */
+			thread_setpriority(PRI_LOWEST);
+		}
+		splx(spl);
+
+		/* The actual freeing is done with interrupts on. */
+		while ((z = threadlist_remhead(&batch)) != NULL) {
+			thread_reap(z);
+		}
+
+		thread_yield();
+	}
+}
+
+/*
+ * Raise cpu C's reaper to PRI_HIGHEST, requeueing it if it's already
+ * waiting at PRI_LOWEST. Called from thread_switch with C's run queue
+ * locked once the zombie list is over ZOMBIE_HIWAT. The reaper is
+ * pinned to C, so this and the reaper lowering itself again, both done
+ * on C with interrupts off, can't overlap.
+ */
+static
+void
+thread_reaper_boost(struct cpu *c)
+{
+	struct thread *r = c->c_reaper;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (r == NULL || r->t_priority == PRI_HIGHEST) {
+		return;
+	}
+	r->t_priority = PRI_HIGHEST;
+	if (r->t_state == S_READY) {
+		runqueue_remove(&c->c_runqueue, r);
+		runqueue_add(&c->c_runqueue, r);
+	}
+}
+
+/*
+ * Start the reaper for cpu C.
+ */
+static
+void
+thread_reaper_start(struct cpu *c)
+{
+	c->c_reaper_wc = wchan_create("reaper");
+	if (c->c_reaper_wc == NULL) {
+		panic("thread_reaper_start: Out of memory\n");
+	}
+
+	c->c_reaper = thread_fork_pinned("reaper", c, PRI_LOWEST,
+					 thread_reaper, c, 0);
+}
+
+/*
+ * Create a thread bound to cpu C. Like thread_fork, except that the
+ * new thread belongs to C rather than to the current cpu, and
+ * thread_consider_migration leaves it there.
+ */
+struct thread *
+thread_fork_pinned(const char *name, struct cpu *c, unsigned pri,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
+{
+	struct thread *t;
+
+	t = thread_create(name, false);
+	if (t == NULL) {
+		panic("thread_fork_pinned: Out of memory\n");
+	}
+	t->t_stack = kmalloc(STACK_SIZE);
+	if (t->t_stack == NULL) {
+		panic("thread_fork_pinned: Out of memory\n");
+	}
+	thread_checkstack_init(t);
+
+	t->t_cpu = c;
+	t->t_priority = pri;
+	t->t_pinned = true;
+
+	/* See thread_fork */
+	t->t_iplhigh_count++;
+	switchframe_init(t, entrypoint, data1, data2);
+
+	thread_make_runnable(t, false);
+	return t;
 }
 
 /*
@@ -319,9 +608,11 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	curcpu->c_runqueue.rq_bitmap = 0;
+	curcpu->c_runqueue.rq_count = 0;
+	curcpu->c_rtqueue.tl_count = 0;
+	curcpu->c_rtqueue.tl_head.tln_next = NULL;
+	curcpu->c_rtqueue.tl_tail.tln_prev = NULL;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -393,6 +684,17 @@ thread_bootstrap(void)
 	curthread->t_cpu = curcpu;
 	curcpu->c_curthread = curthread;
 
+#if OPT_HASHWAIT
+	{
+		unsigned i;
+
+		for (i=0; i<WAITQ_SIZE; i++) {
+			threadlist_init(&waitqueues[i].wq_threads);
+			spinlock_init(&waitqueues[i].wq_lock);
+		}
+	}
+#endif
+
 	/* Done */
 }
 
@@ -437,6 +739,211 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		thread_reaper_start(cpuarray_get(&allcpus, i));
+		workqueue_start(cpuarray_get(&allcpus, i));
+	}
+}
+
+/*
+ * Real-time (EDF) run queue helpers. SPB & FAR
+ *
+ * All of these are called with the cpu's runqueue lock held. Times
+ * are in hardclocks of that cpu; RT_BEFORE compares them so that
+ * wraparound of c_hardclocks does not matter.
+ */
+#define RT_BEFORE(a, b)		((int)((a) - (b)) < 0)
+
+/* Utilization of one EDF thread, in RT_UTIL_SCALE units. */
+static
+unsigned
+thread_rt_util(struct thread *t)
+{
+	return DIVROUNDUP(t->t_rt_budget * RT_UTIL_SCALE, t->t_rt_period);
+}
+
+/*
+ * Queue an EDF thread on C. Throttled threads are parked until their
+ * next period; everyone else goes into c_rtqueue in deadline order
+ * (FIFO among equal deadlines).
+ */
+static
+void
+thread_rt_enqueue(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (t->t_rt_throttled) {
+		threadlist_addtail(&c->c_rtthrottled, t);
+		return;
+	}
+
+	/* Waking up after the period ended starts a fresh job. */
+	if (!RT_BEFORE(c->c_hardclocks, t->t_rt_deadline)) {
+		t->t_rt_deadline = c->c_hardclocks + t->t_rt_period;
+		t->t_rt_used = 0;
+	}
+
+	for (tln = c->c_rtqueue.tl_head.tln_next;
+	     tln != &c->c_rtqueue.tl_tail;
+	     tln = tln->tln_next) {
+		if (RT_BEFORE(t->t_rt_deadline, tln->tln_self->t_rt_deadline)) {
+			threadlist_insertbefore(&c->c_rtqueue, t,
+						tln->tln_self);
+			return;
+		}
+	}
+	threadlist_addtail(&c->c_rtqueue, t);
+}
+
+/*
+ * Move throttled threads whose period has ended back onto the run
+ * queue with a fresh budget.
+ */
+static
+void
+thread_rt_release(struct cpu *c)
+{
+	struct threadlistnode *tln, *next;
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	tln = c->c_rtthrottled.tl_head.tln_next;
+	while (tln != &c->c_rtthrottled.tl_tail) {
+		next = tln->tln_next;
+		t = tln->tln_self;
+		if (!RT_BEFORE(c->c_hardclocks, t->t_rt_deadline)) {
+			threadlist_remove(&c->c_rtthrottled, t);
+			t->t_rt_throttled = false;
+			t->t_rt_deadline += t->t_rt_period;
+			t->t_rt_used = 0;
+			thread_rt_enqueue(c, t);
+		}
+		tln = next;
+	}
+}
+
+/*
+ * Charge one hardclock to the running EDF thread CUR. If its period
+ * ran out with the job unfinished, that's a missed deadline and the
+ * job is pushed to the next period; if its budget ran out first, it
+ * gets throttled.
+ */
+static
+void
+thread_rt_tick(struct cpu *c, struct thread *cur)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	cur->t_rt_used++;
+	if (!RT_BEFORE(c->c_hardclocks, cur->t_rt_deadline)) {
+		cur->t_rt_misses++;
+		c->c_rt_misses++;
+		cur->t_rt_deadline = c->c_hardclocks + cur->t_rt_period;
+		cur->t_rt_used = 0;
+	}
+	else if (cur->t_rt_used >= cur->t_rt_budget) {
+		cur->t_rt_overruns++;
+		cur->t_rt_throttled = true;
+	}
+}
+
+/*
+ * Return true if CUR, which is yielding, may keep the cpu: nothing
+ * else is runnable, or CUR is a real-time thread with budget left and
+ * no earlier deadline is waiting. Normal threads never preempt
+ * real-time ones.
+ */
+static
+bool
+thread_can_keep_running(struct cpu *c, struct thread *cur)
+{
+	struct thread *head;
+
+	if (cur->t_class == SCHED_NORMAL) {
+		return threadlist_isempty(&c->c_rtqueue) &&
+			runqueue_isempty(&c->c_runqueue);
+	}
+	if (cur->t_rt_throttled) {
+		return false;
+	}
+	if (threadlist_isempty(&c->c_rtqueue)) {
+		return true;
+	}
+	head = c->c_rtqueue.tl_head.tln_next->tln_self;
+	return RT_BEFORE(cur->t_rt_deadline, head->t_rt_deadline);
+}
+
+/*
+ * Pick the next thread to run on C: the earliest-deadline real-time
+ * thread if there is one, then the target of a directed yield, and
+ * otherwise the head of the normal queue.
+ */
+static
+struct thread *
+thread_pick_next(struct cpu *c)
+{
+	struct thread *next;
+
+	next = threadlist_remhead(&c->c_rtqueue);
+	if (next == NULL && c->c_yieldto != NULL) {
+		next = c->c_yieldto;
+		runqueue_remove(&c->c_runqueue, next);
+	}
+	else if (next == NULL) {
+		next = runqueue_remhead(&c->c_runqueue);
+	}
+	c->c_yieldto = NULL;
+	return next;
+}
+
+/*
+ * Decide whether AS has to be loaded into C's MMU, and if so record
+ * that it is about to be. Kernel-only threads (AS == NULL) leave the
+ * MMU alone. Called with C's runqueue lock held.
+ */
+static
+bool
+thread_as_needs_activate(struct cpu *c, struct addrspace *as)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (as == NULL) {
+		return false;
+	}
+	if (as == c->c_curas) {
+		c->c_as_skipped++;
+		return false;
+	}
+	c->c_curas = as;
+	c->c_as_activations++;
+	return true;
+}
+
+/*
+ * Put TARGET on TARGETCPU's run queue, in its class's queue. The
+ * caller holds TARGETCPU's runqueue lock and takes care of waking the
+ * cpu up if it's idle.
+ */
+static
+void
+thread_enqueue(struct cpu *targetcpu, struct thread *target)
+{
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	KASSERT(target->t_cpu == targetcpu);
+
+	target->t_state = S_READY;
+	if (target->t_class == SCHED_EDF) {
+		thread_rt_enqueue(targetcpu, target);
+	}
+	else {
+		runqueue_add(&targetcpu->c_runqueue, target);
+	}
+	SWTRACE(SWT_READY, curthread, target, S_READY, NULL);
 }
 
 /*
@@ -463,7 +970,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -487,16 +994,50 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * but inherits its current working directory from the caller. It will
  * start on the same CPU as the caller, unless the scheduler
  * intervenes first.
+ *
+ * Its process is detached: nobody waits for it, and it is freed when
+ * it exits. Use thread_fork_child for one the caller will wait for.
  */
 int
 thread_fork(const char *name,
 	    void (*entrypoint)(void *data1, unsigned long data2),
 	    void *data1, unsigned long data2,
 	    struct thread **ret)
+{
+	return thread_fork_common(name, false, entrypoint, data1, data2,
+				  ret, NULL);
+}
+
+/*
+ * Like thread_fork, but the new thread's process is a child of the
+ * current one, and stays around after exiting until waited for. Its
+ * PID goes in *CHILDPID; the thread itself isn't handed back, since
+ * the child may be gone by the time we return.
+ */
+int
+thread_fork_child(const char *name,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2,
+		  pid_t *childpid)
+{
+	return thread_fork_common(name, true, entrypoint, data1, data2,
+				  NULL, childpid);
+}
+
+/*
+ * Common part of thread_fork and thread_fork_child. CHILDPID, if not
+ * NULL, is filled in before the new thread can run.
+ */
+static
+int
+thread_fork_common(const char *name, bool child,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2,
+		   struct thread **ret, pid_t *childpid)
 {
 	struct thread *newthread;
 
-	newthread = thread_create(name);
+	newthread = thread_create(name, child);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
@@ -515,6 +1056,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_priority = curthread->t_priority;
 
 	/* VM fields */
 	/* do not clone address space -- let caller decide on that */
@@ -535,6 +1077,11 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	/* Once it's runnable it may exit and give up its PID */
+	if (childpid != NULL) {
+		*childpid = newthread->pid;
+	}
+
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
@@ -565,6 +1112,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	bool activate;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -575,6 +1123,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 
 	cur = curthread;
 
+	/*
+	 * hardclock() yields from interrupt context once per tick,
+	 * idle or not; that tick also releases delayed work.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		workqueue_tick();
+	}
+
 	/*
 	 * If we're idle, return without doing anything. This happens
 	 * when the timer interrupt interrupts the idle loop.
@@ -590,13 +1146,35 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/*
+	 * hardclock() yields from interrupt context once per tick;
+	 * charge that tick to a real-time thread's budget. Then start
+	 * the next period of any throttled real-time threads.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_ru.ru_ticks++;
+		if (cur->t_class == SCHED_EDF) {
+			thread_rt_tick(curcpu, cur);
+		}
+	}
+	thread_rt_release(curcpu);
+
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && thread_can_keep_running(curcpu, cur)) {
+		curcpu->c_yieldto = NULL;
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* We're giving up the cpu; preempted by the tick, or on our own? */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_ru.ru_nivcsw++;
+	}
+	else {
+		cur->t_ru.ru_nvcsw++;
+	}
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -607,6 +1185,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -620,12 +1199,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * or want it locked and if it does can lock it itself
 		 * without racing. Exercise: what's the other?)
 		 */
-		threadlist_addtail(&wc->wc_threads, cur);
+		wchan_addsleeper(wc, cur);
 		wchan_unlock(wc);
 		break;
 	    case S_ZOMBIE:
 		cur->t_wchan_name = "ZOMBIE";
 		threadlist_addtail(&curcpu->c_zombies, cur);
+		if (curcpu->c_zombies.tl_count > ZOMBIE_HIWAT) {
+			thread_reaper_boost(curcpu);
+		}
 		break;
 	}
 	cur->t_state = newstate;
@@ -650,7 +1232,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		thread_rt_release(curcpu);
+		next = thread_pick_next(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
@@ -659,6 +1242,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Only a thread going to sleep has a wait channel to report */
+	SWTRACE(SWT_SWITCH, cur, next, newstate,
+		newstate == S_SLEEP ? cur->t_wchan_name : NULL);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -723,16 +1310,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* See if our address space is already the one in the MMU. */
+	activate = thread_as_needs_activate(curcpu, cur->t_addrspace);
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
-	/* If we have an address space, activate it in the MMU. */
-	if (cur->t_addrspace != NULL) {
+	/* If we have an address space that isn't loaded, activate it. */
+	if (activate) {
 		as_activate(cur->t_addrspace);
 	}
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Clean up dead threads, if the reaper can't. */
+	if (curcpu->c_reaper == NULL ||
+	    curcpu->c_zombies.tl_count > ZOMBIE_HIWAT) {
+		exorcise();
+	}
 
 	/* Turn interrupts back on. */
 	splx(spl);
@@ -751,6 +1344,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	       void *data1, unsigned long data2)
 {
 	struct thread *cur;
+	bool activate;
 
 	cur = curthread;
 
@@ -758,16 +1352,22 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* See if our address space is already the one in the MMU. */
+	activate = thread_as_needs_activate(curcpu, cur->t_addrspace);
+
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
-	/* If we have an address space, activate it in the MMU. */
-	if (cur->t_addrspace != NULL) {
+	/* If we have an address space that isn't loaded, activate it. */
+	if (activate) {
 		as_activate(cur->t_addrspace);
 	}
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Clean up dead threads, if the reaper can't. */
+	if (curcpu->c_reaper == NULL ||
+	    curcpu->c_zombies.tl_count > ZOMBIE_HIWAT) {
+		exorcise();
+	}
 
 	/* Enable interrupts. */
 	spl0();
@@ -794,8 +1394,8 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
  * Cause the current thread to exit.
  *
  * The parts of the thread structure we don't actually need to run
- * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
+ * should be cleaned up right away. The rest has to wait until the
+ * reaper gets to it (or exorcise(), if we have no address space).
  *
  * Does not return.
  */
@@ -806,24 +1406,29 @@ thread_exit(void)
 
 	cur = curthread;
 
+	/*
+	 * Process exit, for threads that didn't come through sys__exit
+	 * (kernel threads, or a program that failed to start), so that
+	 * whoever waits for them gets status 0 and orphans get freed.
+	 * After sys__exit this does nothing.
+	 */
+	proc_exit(0);
+
 	/* VFS fields */
 	if (cur->t_cwd) {
 		VOP_DECREF(cur->t_cwd);
 		cur->t_cwd = NULL;
 	}
 
-	/* VM fields */
-	if (cur->t_addrspace) {
-		/*
-		 * Clear t_addrspace before calling as_destroy. Otherwise
-		 * if as_destroy sleeps (which is quite possible) when we
-		 * come back we'll call as_activate on a half-destroyed
-		 * address space, which is usually messily fatal.
-		 */
-		struct addrspace *as = cur->t_addrspace;
-		cur->t_addrspace = NULL;
-		as_activate(NULL);
-		as_destroy(as);
+	/*
+	 * VM fields: the address space stays with the zombie and is
+	 * destroyed by thread_reap. Nobody else runs in it, so it just
+	 * sits in the MMU until the next user thread replaces it.
+	 */
+
+	/* Give back any real-time utilization we were admitted with */
+	if (cur->t_class == SCHED_EDF) {
+		thread_edf_clear();
 	}
 
 	/* Check the stack guard band. */
@@ -831,6 +1436,15 @@ thread_exit(void)
 
 	/* Interrupts off on this processor */
         splhigh();
+
+	/*
+	 * Let the reaper know there's work. With interrupts off we
+	 * stay on this cpu, and it can't run until we've switched
+	 * away and are on c_zombies.
+	 */
+	if (curcpu->c_reaper_wc != NULL) {
+		wchan_wakeone(curcpu->c_reaper_wc);
+	}
 	thread_switch(S_ZOMBIE, NULL);
 	panic("The zombie walks!\n");
 }
@@ -844,6 +1458,53 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Yield the cpu directly to TARGET. SPB & FAR
+ *
+ * Threads that are runnable are in S_READY and sit on their t_cpu's
+ * run queue, and nobody but this cpu ever takes a thread off our run
+ * queue. So if TARGET checks out under our runqueue lock it will still
+ * be there when thread_switch picks it, as long as interrupts stay off
+ * in between; splhigh makes sure they do even after INTERLOCK goes.
+ *
+ * If TARGET is anywhere else we don't yield at all, and the caller
+ * goes on to sleep instead. Real-time threads are left to the EDF
+ * ordering: yielding would just put an EDF thread back at the head of
+ * its queue, where it would spin on whatever it's waiting for.
+ */
+bool
+thread_yield_to(struct thread *target, struct spinlock *interlock)
+{
+	struct thread *cur = curthread;
+	bool handoff;
+	int spl;
+
+	KASSERT(!cur->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(interlock));
+	KASSERT(target != cur);
+
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	handoff = target->t_state == S_READY &&
+		target->t_cpu == curcpu->c_self &&
+		target->t_class == SCHED_NORMAL &&
+		cur->t_class == SCHED_NORMAL;
+	if (handoff) {
+		curcpu->c_yieldto = target;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (!handoff) {
+		splx(spl);
+		return false;
+	}
+
+	spinlock_release(interlock);
+	thread_switch(S_READY, NULL);
+	splx(spl);
+	return true;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -868,6 +1529,155 @@ schedule(void)
 }
 #endif
 
+/*
+ * Address space activation. SPB & FAR
+ *
+ * splhigh keeps us on this cpu between deciding and activating, so
+ * c_curas can't end up describing some other cpu's MMU.
+ */
+void
+thread_as_activate(struct addrspace *as)
+{
+	bool activate;
+	int spl;
+
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	activate = thread_as_needs_activate(curcpu->c_self, as);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	if (activate) {
+		as_activate(as);
+	}
+	splx(spl);
+}
+
+/*
+ * AS is about to be destroyed, or its ASID retired; make sure no cpu
+ * thinks it's loaded, since a new address space may be allocated at
+ * the same address, or the cpu's EntryHi holds the old ASID.
+ */
+void
+thread_as_forget(struct addrspace *as)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (c->c_curas == as) {
+			c->c_curas = NULL;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+}
+
+void
+thread_as_stats(unsigned *activations, unsigned *skipped)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	*activations = *skipped = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		*activations += c->c_as_activations;
+		*skipped += c->c_as_skipped;
+	}
+}
+
+/*
+ * Priority of normal-class threads. The current thread isn't on a run
+ * queue, so there's nothing to requeue; the new level applies the next
+ * time it yields or wakes up.
+ */
+void
+thread_setpriority(unsigned pri)
+{
+	KASSERT(pri <= PRI_LOWEST);
+	curthread->t_priority = pri;
+}
+
+/*
+ * Earliest-deadline-first real-time class. SPB & FAR
+ *
+ * The calling thread is admitted on its current cpu and stays there;
+ * thread_consider_migration only ever moves threads on c_runqueue.
+ * splhigh keeps us from being preempted (and possibly migrated)
+ * between looking at curcpu and locking its run queue.
+ */
+int
+thread_edf_set(unsigned period, unsigned budget)
+{
+	struct thread *cur = curthread;
+	unsigned newutil, oldutil;
+	int spl;
+
+	if (period == 0 || budget == 0 || budget > period) {
+		return EINVAL;
+	}
+	newutil = DIVROUNDUP(budget * RT_UTIL_SCALE, period);
+
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	oldutil = (cur->t_class == SCHED_EDF) ? thread_rt_util(cur) : 0;
+	if (curcpu->c_rt_util - oldutil + newutil > RT_UTIL_MAX) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		splx(spl);
+		return EBUSY;
+	}
+	curcpu->c_rt_util = curcpu->c_rt_util - oldutil + newutil;
+
+	cur->t_class = SCHED_EDF;
+	cur->t_rt_period = period;
+	cur->t_rt_budget = budget;
+	cur->t_rt_used = 0;
+	cur->t_rt_deadline = curcpu->c_hardclocks + period;
+	cur->t_rt_throttled = false;
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+	splx(spl);
+	return 0;
+}
+
+void
+thread_edf_clear(void)
+{
+	struct thread *cur = curthread;
+	int spl;
+
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (cur->t_class == SCHED_EDF) {
+		KASSERT(curcpu->c_rt_util >= thread_rt_util(cur));
+		curcpu->c_rt_util -= thread_rt_util(cur);
+		cur->t_class = SCHED_NORMAL;
+		cur->t_rt_throttled = false;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	splx(spl);
+}
+
+/*
+ * Finish this period's job early: park on the throttled list until
+ * the period ends, then come back with a fresh budget.
+ */
+void
+thread_edf_yield(void)
+{
+	int spl;
+
+	KASSERT(curthread->t_class == SCHED_EDF);
+
+	spl = splhigh();
+	curthread->t_rt_throttled = true;
+	thread_switch(S_READY, NULL);
+	splx(spl);
+}
+
 /*
  * Thread migration.
  *
@@ -899,9 +1709,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runqueue.rq_count;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runqueue.rq_count;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -915,7 +1725,7 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(&curcpu->c_runqueue);
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -926,7 +1736,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runqueue.rq_count < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -956,8 +1766,19 @@ thread_consider_migration(void)
 				continue;
 			}
 
+			/*
+			 * Per-cpu service threads (the reaper, the
+			 * workqueue worker) have to stay with their
+			 * cpu; skip them the same way.
+			 */
+			if (t->t_pinned) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
+
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(&c->c_runqueue, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -981,7 +1802,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(&curcpu->c_runqueue, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1014,7 +1835,9 @@ wchan_create(const char *name)
 		return NULL;
 	}
 	spinlock_init(&wc->wc_lock);
+#if !OPT_HASHWAIT
 	threadlist_init(&wc->wc_threads);
+#endif
 	wc->wc_name = name;
 	return wc;
 }
@@ -1026,8 +1849,12 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
-	spinlock_cleanup(&wc->wc_lock);
+#if OPT_HASHWAIT
+	KASSERT(wchan_isempty(wc));
+#else
 	threadlist_cleanup(&wc->wc_threads);
+#endif
+	spinlock_cleanup(&wc->wc_lock);
 	kfree(wc);
 }
 
@@ -1046,6 +1873,72 @@ wchan_unlock(struct wchan *wc)
 	spinlock_release(&wc->wc_lock);
 }
 
+/*
+ * Put thread T, which is going to sleep on WC, on the channel's list.
+ * The channel must be locked.
+ */
+static
+void
+wchan_addsleeper(struct wchan *wc, struct thread *t)
+{
+#if OPT_HASHWAIT
+	struct waitqueue *wq = wchan_queue(wc);
+#endif
+
+	KASSERT(t->t_wchan == wc);
+#if OPT_HASHWAIT
+	spinlock_acquire(&wq->wq_lock);
+	threadlist_addtail(&wq->wq_threads, t);
+	spinlock_release(&wq->wq_lock);
+#else
+	threadlist_addtail(&wc->wc_threads, t);
+#endif
+}
+
+/*
+ * Move the threads sleeping on WC onto LIST, in the order they went
+ * to sleep: only the first one, or every one if ALL. Under hashwait
+ * that is one pass over the shared queue however many match.
+ * The channel must be locked.
+ */
+static
+void
+wchan_takesleepers(struct wchan *wc, struct threadlist *list, bool all)
+{
+	struct thread *t;
+#if OPT_HASHWAIT
+	struct waitqueue *wq = wchan_queue(wc);
+	struct threadlistnode *tln, *next;
+
+	spinlock_acquire(&wq->wq_lock);
+	tln = wq->wq_threads.tl_head.tln_next;
+	while (tln != &wq->wq_threads.tl_tail) {
+		next = tln->tln_next;
+		t = tln->tln_self;
+		if (t->t_wchan == wc) {
+			threadlist_remove(&wq->wq_threads, t);
+			t->t_wchan = NULL;
+			threadlist_addtail(list, t);
+			if (!all) {
+				break;
+			}
+		}
+		tln = next;
+	}
+	spinlock_release(&wq->wq_lock);
+#else
+	/* Everybody on the list is ours */
+	while ((t = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		KASSERT(t->t_wchan == wc);
+		t->t_wchan = NULL;
+		threadlist_addtail(list, t);
+		if (!all) {
+			break;
+		}
+	}
+#endif
+}
+
 /*
  * Yield the cpu to another process, and go to sleep, on the specified
  * wait channel WC. Calling wakeup on the channel will make the thread
@@ -1058,6 +1951,7 @@ wchan_sleep(struct wchan *wc)
 	/* may not sleep in an interrupt handler */
 	KASSERT(!curthread->t_in_interrupt);
 
+	SWTRACE(SWT_SLEEP, curthread, NULL, S_SLEEP, wc->wc_name);
 	thread_switch(S_SLEEP, wc);
 }
 
@@ -1068,15 +1962,21 @@ void
 wchan_wakeone(struct wchan *wc)
 {
 	struct thread *target;
+	struct threadlist list;
+
+	threadlist_init(&list);
 
 	/* Lock the channel and grab a thread from it */
-	spinlock_acquire(&wc->wc_lock);
-	target = threadlist_remhead(&wc->wc_threads);
+	wchan_lock(wc);
+	wchan_takesleepers(wc, &list, false);
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
 	 */
-	spinlock_release(&wc->wc_lock);
+	wchan_unlock(wc);
+
+	target = threadlist_remhead(&list);
+	threadlist_cleanup(&list);
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
@@ -1092,8 +1992,10 @@ wchan_wakeone(struct wchan *wc)
 void
 wchan_wakeall(struct wchan *wc)
 {
-	struct thread *target;
+	struct thread *target, *t;
+	struct threadlistnode *tln, *next;
 	struct threadlist list;
+	struct cpu *c;
 
 	threadlist_init(&list);
 
@@ -1101,23 +2003,46 @@ wchan_wakeall(struct wchan *wc)
 	 * Lock the channel and grab all the threads, moving them to a
 	 * private list.
 	 */
-	spinlock_acquire(&wc->wc_lock);
-	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
-		threadlist_addtail(&list, target);
-	}
+	wchan_lock(wc);
+	wchan_takesleepers(wc, &list, true);
 	/*
 	 * Nobody else can wake up these threads now, so we don't need
 	 * to hang onto the lock.
 	 */
-	spinlock_release(&wc->wc_lock);
+	wchan_unlock(wc);
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Make them runnable a cpu at a time: take the first thread's
+	 * cpu, lock its run queue once, and move over everything on the
+	 * list that belongs to it. That's one lock round trip and at most
+	 * one IPI per cpu, however many threads were waiting.
+	 *
+	 * Sleeping threads can't migrate, so t_cpu holds still.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		c = target->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		thread_enqueue(c, target);
+
+		tln = list.tl_head.tln_next;
+		while (tln != &list.tl_tail) {
+			next = tln->tln_next;
+			t = tln->tln_self;
+			if (t->t_cpu == c) {
+				threadlist_remove(&list, t);
+				thread_enqueue(c, t);
+			}
+			tln = next;
+		}
+
+		if (c->c_isidle) {
+			/*
+			 * Other processor is idle; send interrupt to
+			 * make sure it unidles.
+			 */
+			ipi_send(c, IPI_UNIDLE);
+		}
+		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	threadlist_cleanup(&list);
@@ -1130,11 +2055,29 @@ wchan_wakeall(struct wchan *wc)
 bool
 wchan_isempty(struct wchan *wc)
 {
-	bool ret;
+	bool ret = true;
 
-	spinlock_acquire(&wc->wc_lock);
+	wchan_lock(wc);
+#if OPT_HASHWAIT
+	{
+		struct waitqueue *wq = wchan_queue(wc);
+		struct threadlistnode *tln;
+
+		spinlock_acquire(&wq->wq_lock);
+		for (tln = wq->wq_threads.tl_head.tln_next;
+		     tln != &wq->wq_threads.tl_tail;
+		     tln = tln->tln_next) {
+			if (tln->tln_self->t_wchan == wc) {
+				ret = false;
+				break;
+			}
+		}
+		spinlock_release(&wq->wq_lock);
+	}
+#else
 	ret = threadlist_isempty(&wc->wc_threads);
-	spinlock_release(&wc->wc_lock);
+#endif
+	wchan_unlock(wc);
 
 	return ret;
 }
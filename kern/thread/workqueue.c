@@ -0,0 +1,381 @@
+/*
+ * workqueue.c
+ * SPB & FAR
+ * Per-cpu deferred work; see workqueue.h
+ *   1) work_init
+ *   2) work_queue
+ *   3) work_queue_on
+ *   4) work_queue_delayed
+ *   5) work_cancel
+ *   6) work_flush
+ *   7) workqueue_start
+ *   8) workqueue_tick
+ * Helpers
+ *   1) wq_enqueue
+ *   2) wq_worker
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+/*
+ * Compare two hardclock counts so that wraparound of c_hardclocks
+ * does not matter (same as RT_BEFORE in thread.c).
+ */
+#define WQ_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+/*
+ * One per cpu. Everything here is under wq_lock. The delayed list is
+ * kept soonest first, so the tick only ever looks at its head.
+ */
+struct workqueue {
+	struct spinlock wq_lock;
+	struct work *wq_head;		/* ready to run, in order */
+	struct work *wq_tail;
+	struct work *wq_delayed;	/* waiting for w_expires */
+	struct work *wq_running;	/* what the worker is running now */
+	struct cpu *wq_cpu;
+	struct wchan *wq_wc;		/* where the worker waits for work */
+	struct wchan *wq_donewc;	/* where work_flush waits */
+};
+
+static void wq_enqueue(struct workqueue *wq, struct work *w);
+static void wq_worker(void *data1, unsigned long data2);
+
+/**
+ * work_init
+ * Sets up W to call FUNC(DATA1, DATA2). Call once, before W is first
+ * queued, and not again while it might be queued or running.
+ */
+void
+work_init(struct work *w, work_func_t func, void *data1, unsigned long data2)
+{
+	spinlock_data_set(&w->w_pending, 0);
+	w->w_next = NULL;
+	w->w_queue = NULL;
+	w->w_lastq = NULL;
+	w->w_expires = 0;
+	w->w_func = func;
+	w->w_data1 = data1;
+	w->w_data2 = data2;
+}
+
+/**
+ * work_queue
+ * Queues W on the current cpu. Interrupts are turned off just long
+ * enough to pin down which cpu that is.
+ */
+bool
+work_queue(struct work *w)
+{
+	bool ret;
+	int spl;
+
+	spl = splhigh();
+	ret = work_queue_on(curcpu->c_self, w);
+	splx(spl);
+	return ret;
+}
+
+/**
+ * work_queue_on
+ * Queues W on cpu C. w_pending decides who wins if two callers race to
+ * queue the same item: only the one that sets it goes on.
+ */
+bool
+work_queue_on(struct cpu *c, struct work *w)
+{
+	struct workqueue *wq = c->c_workq;
+
+	KASSERT(wq != NULL);
+
+	if (spinlock_data_testandset(&w->w_pending) != 0) {
+		return false;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	wq_enqueue(wq, w);
+	spinlock_release(&wq->wq_lock);
+
+	wchan_wakeone(wq->wq_wc);
+	return true;
+}
+
+/**
+ * work_queue_delayed
+ * Queues W on the current cpu's delayed list, to be moved over to its
+ * run list by workqueue_tick once TICKS hardclocks have gone by. With
+ * TICKS of 0 this is just work_queue.
+ */
+bool
+work_queue_delayed(struct work *w, unsigned ticks)
+{
+	struct workqueue *wq;
+	struct work **pp;
+	int spl;
+
+	if (ticks == 0) {
+		return work_queue(w);
+	}
+
+	if (spinlock_data_testandset(&w->w_pending) != 0) {
+		return false;
+	}
+
+	spl = splhigh();
+	wq = curcpu->c_workq;
+	KASSERT(wq != NULL);
+
+	spinlock_acquire(&wq->wq_lock);
+	w->w_expires = curcpu->c_hardclocks + ticks;
+	w->w_queue = wq;
+	w->w_lastq = wq;
+	pp = &wq->wq_delayed;
+	while (*pp != NULL && !WQ_BEFORE(w->w_expires, (*pp)->w_expires)) {
+		pp = &(*pp)->w_next;
+	}
+	w->w_next = *pp;
+	*pp = w;
+	spinlock_release(&wq->wq_lock);
+
+	splx(spl);
+	return true;
+}
+
+/**
+ * work_cancel
+ * Unlinks W from whichever list of its queue it is on, if any, and
+ * clears w_pending so it can be queued again. w_lastq is only read
+ * safely under its queue's lock, so check it again there, as
+ * work_flush does.
+ */
+bool
+work_cancel(struct work *w)
+{
+	struct workqueue *wq;
+	struct work **pp, *prev;
+	bool found = false;
+
+	while (1) {
+		wq = w->w_lastq;
+		if (wq == NULL) {
+			return false;
+		}
+		spinlock_acquire(&wq->wq_lock);
+		if (w->w_lastq == wq) {
+			break;
+		}
+		/* Requeued elsewhere meanwhile; look again */
+		spinlock_release(&wq->wq_lock);
+	}
+
+	if (w->w_queue == wq) {
+		prev = NULL;
+		for (pp = &wq->wq_head; *pp != NULL; pp = &(*pp)->w_next) {
+			if (*pp == w) {
+				*pp = w->w_next;
+				if (wq->wq_tail == w) {
+					wq->wq_tail = prev;
+				}
+				found = true;
+				break;
+			}
+			prev = *pp;
+		}
+		for (pp = &wq->wq_delayed; !found && *pp != NULL;
+		     pp = &(*pp)->w_next) {
+			if (*pp == w) {
+				*pp = w->w_next;
+				found = true;
+			}
+		}
+		KASSERT(found);
+		w->w_next = NULL;
+		w->w_queue = NULL;
+		spinlock_data_set(&w->w_pending, 0);
+	}
+	spinlock_release(&wq->wq_lock);
+
+	return found;
+}
+
+/**
+ * work_flush
+ * Sleeps until W is neither on a queue nor being run by its worker.
+ * The worker wakes wq_donewc after every item, so we recheck then.
+ */
+void
+work_flush(struct work *w)
+{
+	struct workqueue *wq;
+
+	KASSERT(!curthread->t_in_interrupt);
+
+	while (1) {
+		wq = w->w_lastq;
+		if (wq == NULL) {
+			return;
+		}
+
+		spinlock_acquire(&wq->wq_lock);
+		if (w->w_lastq != wq) {
+			/* Requeued elsewhere meanwhile; look again */
+			spinlock_release(&wq->wq_lock);
+			continue;
+		}
+		if (w->w_queue != wq && wq->wq_running != w) {
+			spinlock_release(&wq->wq_lock);
+			return;
+		}
+		wchan_lock(wq->wq_donewc);
+		spinlock_release(&wq->wq_lock);
+		wchan_sleep(wq->wq_donewc);
+	}
+}
+
+/**
+ * workqueue_start
+ * Creates cpu C's queue and its worker thread, pinned to C. Called for
+ * each cpu from thread_start_cpus, after which queueing is allowed.
+ */
+void
+workqueue_start(struct cpu *c)
+{
+	struct workqueue *wq;
+	char name[16];
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		panic("workqueue_start: Out of memory\n");
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = NULL;
+	wq->wq_tail = NULL;
+	wq->wq_delayed = NULL;
+	wq->wq_running = NULL;
+	wq->wq_cpu = c;
+	wq->wq_wc = wchan_create("workq");
+	wq->wq_donewc = wchan_create("workq flush");
+	if (wq->wq_wc == NULL || wq->wq_donewc == NULL) {
+		panic("workqueue_start: Out of memory\n");
+	}
+
+	c->c_workq = wq;
+
+	snprintf(name, sizeof(name), "worker/%u", c->c_number);
+	thread_fork_pinned(name, c, PRI_DEFAULT, wq_worker, wq, 0);
+}
+
+/**
+ * workqueue_tick
+ * Moves delayed work that has come due onto the current cpu's run list.
+ * Called from the hardclock path with interrupts off; the worker is
+ * only woken if something actually moved.
+ */
+void
+workqueue_tick(void)
+{
+	struct workqueue *wq = curcpu->c_workq;
+	unsigned now = curcpu->c_hardclocks;
+	struct work *w;
+	bool moved = false;
+
+	if (wq == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	while (wq->wq_delayed != NULL &&
+	       !WQ_BEFORE(now, wq->wq_delayed->w_expires)) {
+		w = wq->wq_delayed;
+		wq->wq_delayed = w->w_next;
+		wq_enqueue(wq, w);
+		moved = true;
+	}
+	spinlock_release(&wq->wq_lock);
+
+	if (moved) {
+		wchan_wakeone(wq->wq_wc);
+	}
+}
+
+/**
+ * wq_enqueue
+ * Appends W to WQ's run list. Caller holds wq_lock and has set
+ * w_pending.
+ */
+static
+void
+wq_enqueue(struct workqueue *wq, struct work *w)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	w->w_next = NULL;
+	w->w_queue = wq;
+	w->w_lastq = wq;
+	if (wq->wq_tail == NULL) {
+		wq->wq_head = w;
+	}
+	else {
+		wq->wq_tail->w_next = w;
+	}
+	wq->wq_tail = w;
+}
+
+/**
+ * wq_worker
+ * Body of each cpu's worker thread. w_pending is cleared before the
+ * function is called, so the function (or anyone else) can queue the
+ * item again. Once the function returns, W may already be freed, so
+ * it is only ever compared against, never dereferenced.
+ */
+static
+void
+wq_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+	work_func_t func;
+	void *d1;
+	unsigned long d2;
+
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			wchan_lock(wq->wq_wc);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wc);
+			spinlock_acquire(&wq->wq_lock);
+		}
+
+		w = wq->wq_head;
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = NULL;
+		}
+		w->w_next = NULL;
+		w->w_queue = NULL;
+		func = w->w_func;
+		d1 = w->w_data1;
+		d2 = w->w_data2;
+		wq->wq_running = w;
+		spinlock_data_set(&w->w_pending, 0);
+		spinlock_release(&wq->wq_lock);
+
+		func(d1, d2);
+
+		spinlock_acquire(&wq->wq_lock);
+		wq->wq_running = NULL;
+		spinlock_release(&wq->wq_lock);
+		wchan_wakeall(wq->wq_donewc);
+	}
+}